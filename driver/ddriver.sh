@@ -20,6 +20,8 @@ cd "$WORK_DIR" || exit
 
 CONFIG_BLOCK_SZ=512
 BLOCK_COUNT=8192
+CONFIG_HDR_SZ=4096
+CONFIG_HDR_MAGIC="44445256"
 
 
 function usage(){
@@ -35,6 +37,7 @@ function usage(){
     echo "用法: ddriver [options]"
     echo "options: "
     echo "-i [k|u]      安装ddriver: [k] - kernel / [u] - user"
+    echo "              内核设备容量可由环境变量DDRIVER_CAPACITY_MB指定(MiB)"
     echo "-t            测试ddriver[请忽略]"
     echo "-d            导出ddriver至当前工作目录[PWD]"
     echo "-r            擦除ddriver"
@@ -44,6 +47,30 @@ function usage(){
     echo "===================================================================="
 }
 
+# 用户态设备的容量由镜像末尾的配置决定，BLOCK_COUNT按镜像大小计算
+function user_block_count() {
+    local size magic
+    size=$(stat -c %s "$USER_DEV_PATH" 2>/dev/null || echo 0)
+    if [ "$size" -gt $CONFIG_HDR_SZ ]; then
+        magic=$(od -An -tx4 -j $((size - CONFIG_HDR_SZ)) -N4 "$USER_DEV_PATH" | tr -d ' ')
+        if [ "$magic" == "$CONFIG_HDR_MAGIC" ]; then
+            size=$((size - CONFIG_HDR_SZ))
+        fi
+    fi
+    if [ "$size" -gt 0 ]; then
+        BLOCK_COUNT=$((size / CONFIG_BLOCK_SZ))
+    fi
+}
+
+# 内核设备的容量由模块参数capacity_mb决定
+function kernel_block_count() {
+    local capacity_mb
+    capacity_mb=$(cat /sys/module/ddriver/parameters/capacity_mb 2>/dev/null)
+    if [ -n "$capacity_mb" ]; then
+        BLOCK_COUNT=$((capacity_mb * 1024 * 1024 / CONFIG_BLOCK_SZ))
+    fi
+}
+
 function restore_bashrc() {
     cp "$HOME"/.bashrc_copy "$HOME"/.bashrc -f  
 }
@@ -80,7 +107,11 @@ function install() {
         sudo rm $KERNEL_DEV_PATH>/dev/null 2>&1 
         sudo rmmod ddriver>/dev/null 2>&1 
         sudo dmesg -C
-        sudo insmod ./ddriver.ko
+        if [ -n "$DDRIVER_CAPACITY_MB" ]; then
+            sudo insmod ./ddriver.ko capacity_mb="$DDRIVER_CAPACITY_MB"
+        else
+            sudo insmod ./ddriver.ko
+        fi
         in=$(dmesg | tail -n 1)
         tokens=("$in")
         major_number=${tokens[${#tokens[*]}-1]}
@@ -122,6 +153,7 @@ function install() {
 
 function test(){
     if [ "$DDRIVER_TYPE" == "k" ]; then   
+        kernel_block_count
         # test read
         sudo dd if=$KERNEL_DEV_PATH of=read1 bs=$CONFIG_BLOCK_SZ count=$BLOCK_COUNT
         # test write
@@ -145,9 +177,11 @@ function dump(){
     sudo rm "$ORIGIN_WORK_DIR"/ddriver_dump>/dev/null 2>&1 
     if [ "$DDRIVER_TYPE" == "k" ]; then  
         echo "目标设备 $KERNEL_DEV_PATH"
+        kernel_block_count
         sudo dd if=$KERNEL_DEV_PATH of="$ORIGIN_WORK_DIR"/ddriver_dump bs=$CONFIG_BLOCK_SZ count=$BLOCK_COUNT
     else 
         echo "目标设备 $USER_DEV_PATH"
+        user_block_count
         dd if="$USER_DEV_PATH" of="$ORIGIN_WORK_DIR"/ddriver_dump bs=$CONFIG_BLOCK_SZ count=$BLOCK_COUNT
     fi
     echo "文件已导出至$ORIGIN_WORK_DIR/ddriver_dump，请安装HexEditor插件查看其内容"
@@ -156,10 +190,14 @@ function dump(){
 function clean(){
     if [ "$DDRIVER_TYPE" == "k" ]; then  
         echo "目标设备 $KERNEL_DEV_PATH"
+        kernel_block_count
         sudo dd if=/dev/zero of=$KERNEL_DEV_PATH bs=$CONFIG_BLOCK_SZ count=$BLOCK_COUNT
     else
         echo "目标设备 $USER_DEV_PATH"
-        dd if=/dev/zero of="$USER_DEV_PATH" bs=$CONFIG_BLOCK_SZ count=$BLOCK_COUNT
+        user_block_count
+        # 打洞使镜像重新变为稀疏，不支持时退化为写0
+        fallocate -p -o 0 -l $((BLOCK_COUNT * CONFIG_BLOCK_SZ)) "$USER_DEV_PATH" 2>/dev/null ||
+            dd if=/dev/zero of="$USER_DEV_PATH" bs=$CONFIG_BLOCK_SZ count=$BLOCK_COUNT conv=notrunc
     fi 
 }
 
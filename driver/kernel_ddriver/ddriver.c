@@ -4,6 +4,13 @@
 #include <linux/fs.h>
 #include <asm/uaccess.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/moduleparam.h>
+#include <linux/uio.h>
+#include <linux/slab.h>
+#include <linux/rwsem.h>
+#include <linux/atomic.h>
+#include <linux/mm.h>
 #include "ddriver_ctl.h"
 /******************************************************************************
 * SECTION: Macro definitions
@@ -27,8 +34,11 @@
                         "filp_open/cpp-filp_open-function-examples.html>"
 #define DRIVER_VERSION  "0.1.0"
 
-#define CONFIG_DISK_SZ  (4 * 1024 * 1024)
+#define CONFIG_DISK_MB  (4)
+#define CONFIG_MAX_DISK_MB (2047)                    /* IOC_REQ_DEVICE_SIZE reports an int */
 #define CONFIG_BLOCK_SZ (512)
+#define CONFIG_LOCK_REGIONS (32)                     /* Save/load holds all: stay below MAX_LOCK_DEPTH */
+#define CONFIG_IMAGE_CHUNK (1024 * 1024)             /* Snapshot/restore transfer size */
 /******************************************************************************
 * SECTION: Macro Functions 
 *******************************************************************************/
@@ -36,14 +46,16 @@
 #define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
 #define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
 
-#define GET_HEAD_POS(disk)      (disk.head - disk.layout)
-#define FORWARD_HEAD(disk, dis) (disk.head += dis)
-#define SET_HEAD(disk, ofs)     (disk.head = disk.layout + ofs)
-#define RESET_HEAD(disk)        (SET_HEAD(disk, 0))
+#define FILE_HANDLE(file)       ((struct ddriver_handle *)(file)->private_data)
+#define GET_HEAD_POS(file)      (FILE_HANDLE(file)->head)
+#define SET_HEAD(file, ofs)     (FILE_HANDLE(file)->head = ofs)
+#define RESET_HEAD(file)        (SET_HEAD(file, 0))
 
-#define INC_READCNT(disk)       (disk.read_cnt++)
-#define INC_WRITECNT(disk)      (disk.write_cnt++)
-#define INC_SEEKCNT(disk)       (disk.seek_cnt++)
+#define INC_READCNT(disk)       (atomic64_inc(&disk.read_cnt))
+#define INC_WRITECNT(disk)      (atomic64_inc(&disk.write_cnt))
+#define INC_SEEKCNT(disk)       (atomic64_inc(&disk.seek_cnt))
+
+#define REGION_OF(ofs)          ((ofs) / disk.region_size)
 /******************************************************************************
 * SECTION: Kernel Module Template
 *******************************************************************************/
@@ -51,46 +63,162 @@ MODULE_LICENSE("GPL");
 MODULE_AUTHOR(DRIVER_AUTHOR);	    
 MODULE_DESCRIPTION(DRIVER_DESC);	
 MODULE_VERSION(DRIVER_VERSION);	
+
+static int capacity_mb = CONFIG_DISK_MB;
+module_param(capacity_mb, int, 0444);
+MODULE_PARM_DESC(capacity_mb, "Disk capacity in MiB, 1 ~ 2047, default 4");
 /******************************************************************************
 * SECTION: Type definitions
 *******************************************************************************/
+struct ddriver_handle                                 /* Per open file, in file->private_data */
+{
+    loff_t head;                                      /* Disk Head, end of the last access */
+};
+
 struct ddriver
 {
-    char layout[CONFIG_DISK_SZ];                      /* Disk Layout */
-    char *head;                                       /* Disk Head */
-    int  read_cnt;
-    int  write_cnt;
-    int  seek_cnt;
+    char *layout;                                     /* Disk Layout, vmalloc_user'd */
+    atomic64_t read_cnt;
+    atomic64_t write_cnt;
+    atomic64_t seek_cnt;
     int  major_num;
-    int  open_count;
-    int  layout_size;
+    atomic_t open_count;
+    loff_t layout_size;
+    loff_t region_size;                               /* Bytes guarded by one region lock */
     int  iounit_size;
+    struct rw_semaphore region_locks[CONFIG_LOCK_REGIONS];
+    struct lock_class_key region_keys[CONFIG_LOCK_REGIONS];   /* Own class each, lock_range nests them */
 };
 
 static struct ddriver disk = {
-    .head        = NULL,
-    .read_cnt    = 0,
-    .write_cnt   = 0,
-    .seek_cnt    = 0,
+    .read_cnt    = ATOMIC64_INIT(0),
+    .write_cnt   = ATOMIC64_INIT(0),
+    .seek_cnt    = ATOMIC64_INIT(0),
     .major_num   = 0,
-    .open_count  = 0,
-    .layout_size = CONFIG_DISK_SZ,
+    .open_count  = ATOMIC_INIT(0),
+    .layout_size = 0,
     .iounit_size = CONFIG_BLOCK_SZ
 };
 /******************************************************************************
 * SECTION: Helper Functions
 *******************************************************************************/
-int check_valid(size_t size){
-    if (GET_HEAD_POS(disk) >=  CONFIG_DISK_SZ) {
-        kernel_alert("disk head reach the end");
+int check_valid(loff_t pos, size_t size){
+    if (!IS_ADDR_ALIGN(pos)) {
+        kernel_alert("offset %lld must be aligned to block size %d", pos, CONFIG_BLOCK_SZ);
         return -EINVAL;
     }
-    if (size != CONFIG_BLOCK_SZ){
-        kernel_alert("io size %ld should align to %d", size, CONFIG_BLOCK_SZ);
+    if (size == 0 || size % CONFIG_BLOCK_SZ != 0){
+        kernel_alert("io size %zu should align to %d", size, CONFIG_BLOCK_SZ);
         return -EIO;
     }
+    if (pos < 0 || pos + size > disk.layout_size) {
+        kernel_alert("io [%lld, %lld) out of disk", pos, pos + (loff_t)size);
+        return -EINVAL;
+    }
+    return 0;
+}
+/**
+ * @brief Lock the regions covering [pos, pos + size), in ascending order
+ * 
+ * @param write         Exclusive for writes, shared for reads
+ */
+static void 
+lock_range(loff_t pos, size_t size, int write) {
+    loff_t i;
+    for (i = REGION_OF(pos); i <= REGION_OF(pos + size - 1); i++) {
+        if (write)
+            down_write(&disk.region_locks[i]);
+        else
+            down_read(&disk.region_locks[i]);
+    }
+}
+
+static void 
+unlock_range(loff_t pos, size_t size, int write) {
+    loff_t i;
+    for (i = REGION_OF(pos + size - 1); i >= REGION_OF(pos); i--) {
+        if (write)
+            up_write(&disk.region_locks[i]);
+        else
+            up_read(&disk.region_locks[i]);
+    }
+}
+/**
+ * @brief Save the whole layout to a file, in @CONFIG_IMAGE_CHUNK chunks
+ * 
+ * @param path          Image file, created or truncated
+ * @return int          state
+ */
+static int 
+image_save(const char *path) {
+    struct file *filp;
+    loff_t pos = 0;
+    ssize_t ret = 0;
+
+    filp = filp_open(path, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0644);
+    if (IS_ERR(filp)) {
+        kernel_alert("can't open image %s, ret %ld", path, PTR_ERR(filp));
+        return PTR_ERR(filp);
+    }
+    lock_range(0, disk.layout_size, 0);
+    while (pos < disk.layout_size) {
+        ret = kernel_write(filp, disk.layout + pos, 
+                           min_t(loff_t, CONFIG_IMAGE_CHUNK, disk.layout_size - pos), &pos);
+        if (ret <= 0)
+            break;
+    }
+    unlock_range(0, disk.layout_size, 0);
+    filp_close(filp, NULL);
+    if (ret <= 0) {
+        kernel_alert("save image %s failed at %lld, ret %zd", path, pos, ret);
+        return ret < 0 ? ret : -EIO;
+    }
     return 0;
 }
+/**
+ * @brief Restore the layout from a file, in @CONFIG_IMAGE_CHUNK chunks, 
+ * the part beyond a shorter image is zeroed
+ * 
+ * @param path          Image file
+ * @return int          state
+ */
+static int 
+image_load(const char *path) {
+    struct file *filp;
+    loff_t pos = 0;
+    ssize_t ret = 0;
+
+    filp = filp_open(path, O_RDONLY | O_LARGEFILE, 0);
+    if (IS_ERR(filp)) {
+        kernel_alert("can't open image %s, ret %ld", path, PTR_ERR(filp));
+        return PTR_ERR(filp);
+    }
+    lock_range(0, disk.layout_size, 1);
+    while (pos < disk.layout_size) {
+        ret = kernel_read(filp, disk.layout + pos, 
+                          min_t(loff_t, CONFIG_IMAGE_CHUNK, disk.layout_size - pos), &pos);
+        if (ret <= 0)
+            break;
+    }
+    if (ret >= 0 && pos < disk.layout_size)
+        memset(disk.layout + pos, 0, disk.layout_size - pos);
+    unlock_range(0, disk.layout_size, 1);
+    filp_close(filp, NULL);
+    if (ret < 0) {
+        kernel_alert("load image %s failed at %lld, ret %zd", path, pos, ret);
+        return ret;
+    }
+    return 0;
+}
+/**
+ * @brief Count a seek when the access does not start at this file's head
+ */
+static void 
+move_head(struct file *file, loff_t pos, size_t size) {
+    if (GET_HEAD_POS(file) != pos)
+        INC_SEEKCNT(disk);
+    SET_HEAD(file, pos + size);
+}
 /******************************************************************************
 * SECTION: Function definitions
 *******************************************************************************/
@@ -98,78 +226,138 @@ static int      device_open(struct inode *, struct file *);
 static int      device_release(struct inode *, struct file *);
 static ssize_t  device_read(struct file *, char *, size_t, loff_t *);
 static ssize_t  device_write(struct file *, const char *, size_t, loff_t *);
+static ssize_t  device_read_iter(struct kiocb *, struct iov_iter *);
+static ssize_t  device_write_iter(struct kiocb *, struct iov_iter *);
 static loff_t   device_seek(struct file *, loff_t, int);
 static long     device_ioctl(struct file *, unsigned int, unsigned long);
+static int      device_mmap(struct file *, struct vm_area_struct *);
 /******************************************************************************
 * SECTION: Global var or structure definitions
 *******************************************************************************/
 static struct file_operations file_ops = {
     .read = device_read,
     .write = device_write,
+    .read_iter = device_read_iter,
+    .write_iter = device_write_iter,
     .open = device_open,
     .llseek = device_seek,
     .unlocked_ioctl = device_ioctl,
+    .mmap = device_mmap,
     .release = device_release
 };
 /******************************************************************************
 * SECTION: Function Implementation
 *******************************************************************************/
 /**
- * @brief Disk Read
+ * @brief Disk Read, read() uses file position, pread() uses its own offset
  * 
  * @param file          Ignored
  * @param user_buffer   User space buffer
- * @param size          Must equal to Blocksize @CONFIG_BLOCK_SZ
- * @param offset        Ignored
+ * @param size          Multiple of Blocksize @CONFIG_BLOCK_SZ
+ * @param offset        Aligned to @CONFIG_BLOCK_SZ, advanced by size
  * @return ssize_t      Bytes have been read 
  */
 static ssize_t 
 device_read(struct file *file, char *user_buffer, size_t size, loff_t *offset) {
-    IGNORE_ARG(offset);
-    IGNORE_ARG(file);
-    int res = check_valid(size);
+    unsigned long left;
+    int res = check_valid(*offset, size);
     if(res < 0)
         return res;
-    if (copy_to_user(user_buffer, disk.head, CONFIG_BLOCK_SZ))
+    lock_range(*offset, size, 0);
+    left = copy_to_user(user_buffer, disk.layout + *offset, size);
+    unlock_range(*offset, size, 0);
+    if (left)
         return -EFAULT;
-    FORWARD_HEAD(disk, CONFIG_BLOCK_SZ);
+    move_head(file, *offset, size);
+    *offset += size;
     INC_READCNT(disk);
-    return CONFIG_BLOCK_SZ;
+    return size;
 }
 /**
- * @brief Disk Write
+ * @brief Disk Write, write() uses file position, pwrite() uses its own offset
  * 
  * @param file          Ignored
  * @param user_buffer   User space buffer, copy content from
- * @param size          Must equal to Blocksize @CONFIG_BLOCK_SZ
- * @param offset        Ignored
+ * @param size          Multiple of Blocksize @CONFIG_BLOCK_SZ
+ * @param offset        Aligned to @CONFIG_BLOCK_SZ, advanced by size
  * @return ssize_t      Bytes have been written
  */
 static ssize_t 
 device_write(struct file *file, const char *user_buffer, size_t size, loff_t *offset) {
-    IGNORE_ARG(offset);
-    IGNORE_ARG(file);
-    int res = check_valid(size);
+    unsigned long left;
+    int res = check_valid(*offset, size);
     if(res < 0)
         return res;
 
-    if (copy_from_user(disk.head, user_buffer, CONFIG_BLOCK_SZ))
+    lock_range(*offset, size, 1);
+    left = copy_from_user(disk.layout + *offset, user_buffer, size);
+    unlock_range(*offset, size, 1);
+    if (left)
         return -EFAULT;
-    FORWARD_HEAD(disk, CONFIG_BLOCK_SZ);
+    move_head(file, *offset, size);
+    *offset += size;
     INC_WRITECNT(disk);
-    return CONFIG_BLOCK_SZ;
+    return size;
 }
 /**
- * @brief Disk Seek
+ * @brief Disk Vectored Read, serves readv()/preadv() in one call
  * 
- * @param file          Ignored
+ * @param iocb          Position in ki_pos, advanced by bytes read
+ * @param to            Destination, total length multiple of @CONFIG_BLOCK_SZ
+ * @return ssize_t      Bytes have been read
+ */
+static ssize_t 
+device_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    size_t size = iov_iter_count(to);
+    size_t copied;
+    int res = check_valid(iocb->ki_pos, size);
+    if(res < 0)
+        return res;
+    lock_range(iocb->ki_pos, size, 0);
+    copied = copy_to_iter(disk.layout + iocb->ki_pos, size, to);
+    unlock_range(iocb->ki_pos, size, 0);
+    if (copied != size)
+        return -EFAULT;
+    move_head(iocb->ki_filp, iocb->ki_pos, size);
+    iocb->ki_pos += size;
+    INC_READCNT(disk);
+    return size;
+}
+/**
+ * @brief Disk Vectored Write, serves writev()/pwritev() in one call
+ * 
+ * @param iocb          Position in ki_pos, advanced by bytes written
+ * @param from          Source, total length multiple of @CONFIG_BLOCK_SZ
+ * @return ssize_t      Bytes have been written
+ */
+static ssize_t 
+device_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    size_t size = iov_iter_count(from);
+    size_t copied;
+    int res = check_valid(iocb->ki_pos, size);
+    if(res < 0)
+        return res;
+    lock_range(iocb->ki_pos, size, 1);
+    copied = copy_from_iter(disk.layout + iocb->ki_pos, size, from);
+    unlock_range(iocb->ki_pos, size, 1);
+    if (copied != size)
+        return -EFAULT;
+    move_head(iocb->ki_filp, iocb->ki_pos, size);
+    iocb->ki_pos += size;
+    INC_WRITECNT(disk);
+    return size;
+}
+/**
+ * @brief Disk Seek, moves the file position used by read()/write()
+ * 
+ * @param file          File position to move
  * @param offset        Aligned to @CONFIG_BLOCK_SZ
- * @param whence        SEEK_CUR, SEEK_SET
+ * @param whence        SEEK_CUR, SEEK_SET, SEEK_END
  * @return loff_t       cur pos
  */
 static loff_t 
 device_seek(struct file *file, loff_t offset, int whence) {
-    IGNORE_ARG(file);
+    loff_t pos;
     if (!IS_ADDR_ALIGN(offset)) {
         kernel_alert("offset %lld must be aligned to block size %d", 
                       offset, CONFIG_BLOCK_SZ);
@@ -178,78 +366,128 @@ device_seek(struct file *file, loff_t offset, int whence) {
     switch (whence)
     {
     case SEEK_SET:
-        SET_HEAD(disk, offset);
+        pos = offset;
         break;
     case SEEK_CUR:
-        FORWARD_HEAD(disk, offset);
+        pos = file->f_pos + offset;
         break;
-    default:
+    case SEEK_END:
+        pos = disk.layout_size + offset;
         break;
+    default:
+        return -EINVAL;
     }
+    if (pos < 0 || pos > disk.layout_size) {
+        kernel_alert("seek error: %lld out of disk", pos);
+        return -EINVAL;
+    }
+    file->f_pos = pos;
+    SET_HEAD(file, pos);
     INC_SEEKCNT(disk);
-    return GET_HEAD_POS(disk);
+    return pos;
 }
 /**
- * @brief Disk ioctl
+ * @brief Disk mmap, maps layout pages directly, bypassing region locks and counters
  * 
  * @param file          Ignored
+ * @param vma           Page offset and length must stay inside the disk
+ * @return int          state
+ */
+static int 
+device_mmap(struct file *file, struct vm_area_struct *vma) {
+    IGNORE_ARG(file);
+    return remap_vmalloc_range(vma, disk.layout, vma->vm_pgoff);
+}
+/**
+ * @brief Disk ioctl
+ * 
+ * @param file          Position rewound on reset
  * @param cmd           Command
  * @param arg           Args
  * @return long         State
  */
 static long 
 device_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
-    IGNORE_ARG(file);
     int ret;
+    int size;
     struct ddriver_state state;
+    struct ddriver_image image;
+    struct ddriver_range range;
     switch (cmd)
     {
     case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
-        ret = copy_to_user((int __user *)arg, &disk.layout_size, sizeof(int));
+        size = disk.layout_size;                      /* Fits: capped by CONFIG_MAX_DISK_MB */
+        ret = copy_to_user((int __user *)arg, &size, sizeof(int));
         if (ret) 
             return -EFAULT;
         break;
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
-        state.read_cnt = disk.read_cnt;
-        state.write_cnt = disk.write_cnt;
-        state.seek_cnt = disk.seek_cnt;
-        ret = copy_to_user((int __user *)arg, &state, sizeof(struct ddriver_state));
+        state.read_cnt = atomic64_read(&disk.read_cnt);
+        state.write_cnt = atomic64_read(&disk.write_cnt);
+        state.seek_cnt = atomic64_read(&disk.seek_cnt);
+        ret = copy_to_user((void __user *)arg, &state, sizeof(struct ddriver_state));
         if (ret) 
             return -EFAULT;
         break;
     case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
-        disk.head = disk.layout;
-        disk.read_cnt = 0;
-        disk.write_cnt = 0;
-        disk.seek_cnt = 0;
+        RESET_HEAD(file);
+        file->f_pos = 0;
+        atomic64_set(&disk.read_cnt, 0);
+        atomic64_set(&disk.write_cnt, 0);
+        atomic64_set(&disk.seek_cnt, 0);
         break;
     case IOC_REQ_DEVICE_IO_SZ:
         ret = copy_to_user((int __user *)arg, &disk.iounit_size, sizeof(int));
         if (ret) 
             return -EFAULT;
         break;
+    case IOC_REQ_DEVICE_SAVE:                         /* Snapshot Device */
+    case IOC_REQ_DEVICE_LOAD:                         /* Restore Device */
+        if (copy_from_user(&image, (void __user *)arg, sizeof(struct ddriver_image)))
+            return -EFAULT;
+        image.path[DDRIVER_IMAGE_PATH_SZ - 1] = '\0';
+        if (cmd == IOC_REQ_DEVICE_SAVE)
+            return image_save(image.path);
+        ret = image_load(image.path);
+        if (ret)
+            return ret;
+        RESET_HEAD(file);
+        file->f_pos = 0;
+        break;
+    case IOC_REQ_DEVICE_DISCARD:                      /* Discard Range */
+        if (copy_from_user(&range, (void __user *)arg, sizeof(struct ddriver_range)))
+            return -EFAULT;
+        if (range.size < 0 || range.size > disk.layout_size)
+            return -EINVAL;
+        ret = check_valid(range.offset, range.size);
+        if (ret)
+            return ret;
+        lock_range(range.offset, range.size, 1);
+        memset(disk.layout + range.offset, 0, range.size);
+        unlock_range(range.offset, range.size, 1);
+        break;
     default:
         break;
     }
     return 0;
 }
 /**
- * @brief Disk Open
+ * @brief Disk Open, every opener gets its own head, concurrent opens are allowed
  * 
  * @param inode         Ignored
- * @param file          Ignored
+ * @param file          Holds the per-file handle
  * @return int          state
  */
 static int 
 device_open(struct inode *inode, struct file *file) {
     IGNORE_ARG(inode);
-    IGNORE_ARG(file);
     
-    if (disk.open_count) {                            /* If device is open, return busy */
-        return -EBUSY;
+    file->private_data = kzalloc(sizeof(struct ddriver_handle), GFP_KERNEL);
+    if (file->private_data == NULL) {
+        return -ENOMEM;
     }
-    RESET_HEAD(disk);                                 /* Everytime close device, reset head */
-    disk.open_count++;
+    RESET_HEAD(file);                                 /* Everytime open device, reset head */
+    atomic_inc(&disk.open_count);
     try_module_get(THIS_MODULE);
     return 0;
 }
@@ -257,7 +495,7 @@ device_open(struct inode *inode, struct file *file) {
  * @brief Disk Close
  * 
  * @param inode         Ignored
- * @param file          Ignored
+ * @param file          Per-file handle freed
  * @return int          state
  */
 static int 
@@ -265,8 +503,9 @@ device_release(struct inode *inode, struct file *file) {
                                                       /* Decrement the open counter and usage count. 
                                                          Without this, the module would not unload. */
     IGNORE_ARG(inode);
-    IGNORE_ARG(file);
-    disk.open_count--;
+    kfree(file->private_data);
+    file->private_data = NULL;
+    atomic_dec(&disk.open_count);
     module_put(THIS_MODULE);
     return 0;
 }
@@ -276,16 +515,36 @@ device_release(struct inode *inode, struct file *file) {
 static int __init 
 ddriver_init(void)
 {
-    int major_num = register_chrdev(0, DEVICE_NAME, &file_ops);   
+    int major_num;
+    int i;
+
+    if (capacity_mb <= 0 || capacity_mb > CONFIG_MAX_DISK_MB) {
+        kernel_alert("capacity %d MiB out of range [1, %d]", capacity_mb, CONFIG_MAX_DISK_MB);
+        return -EINVAL;
+    }
+    disk.layout_size = (loff_t)capacity_mb * 1024 * 1024;
+    disk.region_size = disk.layout_size / CONFIG_LOCK_REGIONS;
+    for (i = 0; i < CONFIG_LOCK_REGIONS; i++) {
+        __init_rwsem(&disk.region_locks[i], "ddriver_region", &disk.region_keys[i]);
+    }
+    disk.layout = vmalloc_user(disk.layout_size);     /* Zeroed and mappable by user space */
+    if (disk.layout == NULL) {
+        kernel_alert("Can't allocate %d MiB disk", capacity_mb);
+        return -ENOMEM;
+    }
+
+    major_num = register_chrdev(0, DEVICE_NAME, &file_ops);   
                                                       /* Register an device */
     if (major_num < 0) {                              /* Register fail */
         kernel_alert("Can't register device, ret %d", major_num);
+        vfree(disk.layout);
+        disk.layout = NULL;
         return major_num;
     } 
     else {                                            /* Register success */                                                  
-        kernel_info("module loaded with device major number %d", major_num);
+        kernel_info("module loaded with %d MiB disk, device major number %d", 
+                    capacity_mb, major_num);
         disk.major_num = major_num;
-        memset(disk.layout, 0, CONFIG_DISK_SZ);
         return 0;
     }
     return 0;
@@ -299,6 +558,8 @@ ddriver_exit(void)
     if(major_num != 0){
         unregister_chrdev(major_num, DEVICE_NAME);
     }
+    vfree(disk.layout);
+    disk.layout = NULL;
 }
 
 module_init(ddriver_init);
@@ -8,14 +8,30 @@
 #define IOC_MAGIC               'A'
 struct ddriver_state
 {
-    int write_cnt;
-    int read_cnt;
-    int seek_cnt;
+    long long write_cnt;
+    long long read_cnt;
+    long long seek_cnt;
 };
 
 #define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)
+#define IOC_REQ_DEVICE_SAVE     _IOW(IOC_MAGIC, 14, struct ddriver_image)
+#define IOC_REQ_DEVICE_LOAD     _IOW(IOC_MAGIC, 15, struct ddriver_image)
+#define IOC_REQ_DEVICE_DISCARD  _IOW(IOC_MAGIC, 16, struct ddriver_range)
+
+#define DDRIVER_IMAGE_PATH_SZ   256
+
+struct ddriver_image
+{
+    char path[DDRIVER_IMAGE_PATH_SZ];
+};
+
+struct ddriver_range
+{
+    long long offset;
+    long long size;
+};
 
 #endif
\ No newline at end of file
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "stdio.h"
 #include "stdlib.h"
 #include <unistd.h>
@@ -10,6 +11,11 @@
 #include "errno.h"
 #include <pwd.h>
 #include <time.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <stdint.h>
 
 extern int errno;
 
@@ -21,18 +27,23 @@ extern int errno;
 * SECTION: Macro definitions
 *******************************************************************************/   
 #define DEVICE_NAME   "ddriver"
-#define DEVICE_LOG    "ddriver_log"
+#define DEVICE_LOG    "_log"                         /* Appended to the image path */
 
 #define user_info(fmt, ...)\
 	do {\
 		printf(USER_INFO DEVICE_NAME " " fmt "\n", ##__VA_ARGS__);\
-        fprintf(debugf, USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
+        fprintf(disk->debugf, USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
+	} while(0)\
+
+#define user_log(fmt, ...)\
+	do {\
+        fprintf(disk->debugf, USER_INFO DEVICE_NAME " " fmt "\n", ##__VA_ARGS__);\
 	} while(0)\
 
 #define user_alert(fmt, ...)\
 	do {\
 		printf(USER_ALERT DEVICE_NAME " " fmt "\n", ##__VA_ARGS__);\
-        fprintf(debugf, USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
+        fprintf(disk->debugf, USER_PANIC  " " fmt "\n", ##__VA_ARGS__);\
 	} while(0)\
 
 #define user_panic(fmt, ...)\
@@ -46,132 +57,1600 @@ extern int errno;
 
 #define CONFIG_DISK_SZ  (4 * 1024 * 1024)
 #define CONFIG_BLOCK_SZ (512)
+#define CONFIG_MAX_QD   (64)
+#define CONFIG_MAX_WORKERS (16)
+#define CONFIG_READ_EXPIRE_US  (50 * 1000)           /* Deadline scheduler expiry */
+#define CONFIG_WRITE_EXPIRE_US (500 * 1000)
+#define CONFIG_MAX_DISK_SZ ((long long)INT_MAX)       /* IOC_REQ_DEVICE_SIZE reports an int */
+#define CONFIG_HDR_SZ   (4096)                       /* Trailer after the last IO unit */
+#define CONFIG_HDR_MAGIC (0x44445256)                /* "DDRV" */
+#define CONFIG_HDR_VERSION (1)
+#define CONFIG_TRACE_NR (4096)                       /* Records buffered before a flush */
+#define CONFIG_MAX_FD   (1024)                       /* Devices are looked up by fd */
+#define CONFIG_STAT_SHARDS (64)                      /* Per-thread counter shards per device */
+#define CONFIG_CACHELINE (64)
 /******************************************************************************
 * SECTION: Macro Functions 
 *******************************************************************************/
 #define IGNORE_ARG(arg)         ((void)arg)
-#define IS_ADDR_ALIGN(addr)     (addr % CONFIG_BLOCK_SZ == 0)
-#define ADDR_ROUND_UP(addr)     ((addr / CONFIG_BLOCK_SZ) * CONFIG_BLOCK_SZ)
+#define IS_ADDR_ALIGN(addr)     (addr % disk->iounit_size == 0)
+#define ADDR_ROUND_UP(addr)     ((addr / disk->iounit_size) * disk->iounit_size)
+
+#define SHARD(disk)             (&disk->shards[stat_shard()])
+#define INC_READCNT(disk)       (__atomic_fetch_add(&SHARD(disk)->read_cnt, 1, __ATOMIC_RELAXED))
+#define INC_WRITECNT(disk)      (__atomic_fetch_add(&SHARD(disk)->write_cnt, 1, __ATOMIC_RELAXED))
+#define INC_SEEKCNT(disk)       (__atomic_fetch_add(&SHARD(disk)->seek_cnt, 1, __ATOMIC_RELAXED))
+
+#define GET_HEAD_POS(disk)      (__atomic_load_n(&disk->head, __ATOMIC_RELAXED))
+#define SET_HEAD(disk, ofs)     (__atomic_store_n(&disk->head, ofs, __ATOMIC_RELAXED))
+#define FORWARD_HEAD(disk, dis) (__atomic_fetch_add(&disk->head, dis, __ATOMIC_RELAXED))
+#define SWAP_HEAD(disk, ofs)    (__atomic_exchange_n(&disk->head, ofs, __ATOMIC_RELAXED))
+#define STAT_ADD(field, val)    (__atomic_fetch_add(&SHARD(disk)->stats.field, val, __ATOMIC_RELAXED))
+
+#define RW_DELAY(disk, rw_ops)  (emulate_delay(disk, disk->rw_ops##_lat))
+#define XFER_DELAY(disk, units) (emulate_delay(disk, (long long)disk->xfer_lat * units))
+
+#define GET_DEVICE(fd, disk)\
+    do {\
+        disk = device_get(fd);\
+        if (disk == NULL)\
+            return -EBADF;\
+    } while (0)\
+
+/******************************************************************************
+* SECTION: Type definitions
+*******************************************************************************/
+struct ddriver_header                                /* Persisted right after the disk layout */
+{
+    uint32_t              magic;
+    uint32_t              version;
+    struct ddriver_config config;
+};
+
+struct ddriver_profile
+{
+    int  read_lat;
+    int  write_lat;
+    int  seek_lat;
+    int  xfer_lat;                                   /* Per 512B, scaled to the IO unit */
+};
+
+struct ddriver_iocb
+{
+    struct ddriver_req* req;
+    long long           submit_us;                   /* Submission time, for latency and deadline */
+    long long           submit_vus;                  /* Submitter's virtual time, see emulate_delay */
+    int                 tag;                         /* Caller tag of the submitter */
+};
+
+struct ddriver_trace
+{
+    FILE*               file;                        /* NULL when tracing is off */
+    int                 nr;
+    long long           start_us;
+    pthread_mutex_t     lock;
+    struct ddriver_trace_rec *recs;                  /* CONFIG_TRACE_NR records */
+};
+
+struct ddriver_queue
+{
+    int                 depth;                       /* Max requests in flight */
+    int                 nr_workers;
+    int                 inflight;                    /* Submitted but not reaped */
+    int                 nr_pending;
+    int                 nr_done;
+    int                 cq_head;
+    int                 stop;
+    int                 policy;                      /* DDRIVER_SCHED_* */
+    off_t               sched_head;                  /* End of the last dispatched request */
+    struct ddriver_sched_stat stat[DDRIVER_SCHED_NR];
+    struct ddriver_iocb pending[CONFIG_MAX_QD];      /* Submission queue, arrival order */
+    struct ddriver_req* done[CONFIG_MAX_QD];         /* Completion ring */
+    long long           done_vus[CONFIG_MAX_QD];     /* Virtual completion time of done[i] */
+    long long           lane_vus[CONFIG_MAX_WORKERS]; /* Virtual time each lane is free, LLONG_MAX busy */
+    pthread_t           workers[CONFIG_MAX_WORKERS];
+    pthread_mutex_t     lock;
+    pthread_cond_t      sq_cond;
+    pthread_cond_t      cq_cond;
+};
+
+struct stripe_wait                                   /* One logical request */
+{
+    int                 pending;                     /* Sub-requests not finished yet */
+    int                 res;                         /* First error, 0 if none */
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+};
+
+struct stripe_job                                    /* Sub-request on one member */
+{
+    struct stripe_job*  next;
+    struct stripe_wait* wait;
+    int                 lane;                        /* Member serving it */
+    int                 op;
+    char*               buf;
+    size_t              size;
+    off_t               offset;                      /* Offset on the member */
+};
+
+struct stripe_lane                                   /* A member and the worker serving it */
+{
+    int                 fd;
+    int                 stop;
+    struct stripe_job*  head;
+    struct stripe_job*  tail;
+    pthread_t           worker;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+};
+
+struct ddriver_stripe
+{
+    int                 nr;
+    int                 unit;                        /* Stripe unit in bytes */
+    struct stripe_lane  lanes[DDRIVER_STRIPE_MAX];
+};
+
+struct ddriver_shard                                 /* Counters of the threads mapped to it */
+{
+    long long           read_cnt;
+    long long           write_cnt;
+    long long           seek_cnt;
+    long long           device_us;                   /* Virtual time of the threads mapped here */
+    struct ddriver_stats stats;                      /* region_sz and busy_us unused */
+} __attribute__((aligned(CONFIG_CACHELINE)));
+
+struct ddriver
+{
+    int  ddriver_fd;                                 /* Disk ddriver_fd */
+    char path[PATH_MAX];                             /* Image or character device */
+    int  backend;                                    /* DDRIVER_BACKEND_* */
+    char *map;                                       /* Disk image, mmap backend only */
+    off_t pos;                                       /* Cursor of seek/read/write */
+    off_t head;                                      /* Last serviced offset */
+    int  read_lat;                                   /* All latencies in us */
+    int  write_lat;
+    int  seek_lat;                                   /* Per full rotation */
+    int  xfer_lat;                                   /* Per IO unit */
+    int  delay_mode;                                 /* DDRIVER_DELAY_* */
+    long long open_us;                               /* Wall clock at open/reset */
+    long long region_sz;                             /* Heat map region, see stats_reset */
+    struct ddriver_shard *shards;                    /* CONFIG_STAT_SHARDS, summed on STATE/STATS */
+    int  track_num;
+    int  major_num;
+    long long layout_size;
+    int  iounit_size;
+    FILE *debugf;                                    /* Per device log */
+    struct ddriver_queue queue;
+    struct ddriver_trace trace;
+    struct ddriver_stripe *stripe;                   /* Members, stripe backend only */
+};
+/******************************************************************************
+* SECTION: Function definitions
+*******************************************************************************/
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+int ddriver_queue_exit(int fd);
+int ddriver_open_ex(char *path, struct ddriver_config *cfg);
+long long now_us();
+void trace_record(struct ddriver_trace *trace, int op, off_t offset, size_t size);
+ssize_t stripe_rw(struct ddriver *disk, int op, const struct iovec *iov, int iovcnt, off_t offset);
+int stripe_discard(struct ddriver *disk, off_t offset, long long size);
+int ddriver_open_stripe(char **paths, int nr, int stripe_unit, struct ddriver_config *cfg);
+int ddriver_ioctl(int fd, unsigned long cmd, void *arg);
+int ddriver_close(int fd);
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+/* reference: https://en.wikipedia.org/wiki/Hard_disk_drive_performance_characteristics */
+const struct ddriver disk_default = {
+    .backend     = DDRIVER_BACKEND_FILE,
+    .map         = NULL,
+    .pos         = 0,
+    .head        = 0,
+    .read_lat    = 2000,    /* 2ms */       
+    .write_lat   = 1000,    /* 1ms */
+    .seek_lat    = 4000,    /* 4.17ms per 360 degree */
+    .xfer_lat    = 5,       /* 5us per 512B, ~100MB/s */
+    .delay_mode  = DDRIVER_DELAY_SLEEP,
+    .major_num   = 0,
+    .track_num   = 100,
+    .layout_size = CONFIG_DISK_SZ,
+    .iounit_size = CONFIG_BLOCK_SZ
+};
+
+struct ddriver_profile profiles[DDRIVER_PROFILE_NR] = {
+    [DDRIVER_PROFILE_NONE] = { 0,    0,    0,    0 },
+    [DDRIVER_PROFILE_HDD]  = { 2000, 1000, 4000, 5 },    /* Same as the default geometry */
+    [DDRIVER_PROFILE_SATA] = { 90,   60,   0,    1 },    /* ~500MB/s */
+    [DDRIVER_PROFILE_NVME] = { 20,   15,   0,    0 },    /* >2GB/s, transfer hidden in the command */
+};
+
+struct ddriver *devices[CONFIG_MAX_FD];              /* Open devices, indexed by fd */
+pthread_mutex_t devices_lock = PTHREAD_MUTEX_INITIALIZER;
+
+__thread int trace_tag = 0;
+__thread int shard_id = -1;                          /* Stat shard of this thread, -1 until first IO */
+__thread long long *delay_sink = NULL;               /* Queue workers collect a request's cost here */
+int shard_next = 0;
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+int check_valid(struct ddriver *disk, size_t size) {
+    if (size != disk->iounit_size){
+        user_alert("io size %ld should align to %d", size, disk->iounit_size);
+        return -EIO;
+    }
+    return 0;
+}
+
+int check_valid_vec(struct ddriver *disk, const struct iovec *iov, int iovcnt, size_t *size) {
+    int i;
+    *size = 0;
+    if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+        user_alert("iovcnt %d out of range", iovcnt);
+        return -EINVAL;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len % disk->iounit_size != 0) {
+            user_alert("iov[%d] size %ld should align to %d", 
+                       i, iov[i].iov_len, disk->iounit_size);
+            return -EIO;
+        }
+        *size += iov[i].iov_len;
+    }
+    if (*size == 0) {
+        user_alert("empty io vector");
+        return -EIO;
+    }
+    return 0;
+}
+
+int check_valid_range(struct ddriver *disk, off_t offset, size_t size) {
+    if (offset < 0 || offset + size > disk->layout_size) {
+        user_alert("io [%ld, %ld) out of disk", offset, offset + size);
+        return -EINVAL;
+    }
+    return 0;
+}
+int check_valid_pos(struct ddriver *disk, size_t size, off_t offset) {
+    if (!IS_ADDR_ALIGN(offset)) {
+        user_alert("offset %ld must be aligned to block size %d", 
+                   offset, disk->iounit_size);
+        return -EINVAL;
+    }
+    if (size == 0 || size % disk->iounit_size != 0) {
+        user_alert("io size %ld should align to %d", size, disk->iounit_size);
+        return -EIO;
+    }
+    return check_valid_range(disk, offset, size);
+}
+
+/**
+ * @brief 后端读，文件后端走preadv，mmap与内核后端直接拷贝，条带后端拆分到各成员
+ * 
+ * @return ssize_t 读出的字节数，负数为-errno
+ */
+ssize_t backend_preadv(struct ddriver *disk, const struct iovec *iov, int iovcnt, off_t offset) {
+    ssize_t ret;
+    int i;
+
+    if (disk->stripe != NULL) {
+        return stripe_rw(disk, DDRIVER_OP_READ, iov, iovcnt, offset);
+    }
+    if (disk->map != NULL) {
+        for (i = 0, ret = 0; i < iovcnt; i++) {
+            memcpy(iov[i].iov_base, disk->map + offset + ret, iov[i].iov_len);
+            ret += iov[i].iov_len;
+        }
+        return ret;
+    }
+    ret = preadv(disk->ddriver_fd, iov, iovcnt, offset);
+    if (ret < 0) {
+        user_panic("read error: %s", strerror(errno));
+        return -errno;
+    }
+    return ret;
+}
+/**
+ * @brief 后端写，文件后端走pwritev，mmap与内核后端直接拷贝，条带后端拆分到各成员
+ * 
+ * @return ssize_t 写入的字节数，负数为-errno
+ */
+ssize_t backend_pwritev(struct ddriver *disk, const struct iovec *iov, int iovcnt, off_t offset) {
+    ssize_t ret;
+    int i;
+
+    if (disk->stripe != NULL) {
+        return stripe_rw(disk, DDRIVER_OP_WRITE, iov, iovcnt, offset);
+    }
+    if (disk->map != NULL) {
+        for (i = 0, ret = 0; i < iovcnt; i++) {
+            memcpy(disk->map + offset + ret, iov[i].iov_base, iov[i].iov_len);
+            ret += iov[i].iov_len;
+        }
+        return ret;
+    }
+    ret = pwritev(disk->ddriver_fd, iov, iovcnt, offset);
+    if (ret < 0) {
+        user_panic("write error: %s", strerror(errno));
+        return -errno;
+    }
+    return ret;
+}
+
+/**
+ * @brief 当前线程的统计分片。线程第一次IO时轮转分配，之后固定不变，
+ * 线程数不超过CONFIG_STAT_SHARDS时每个分片只有一个写者，原子加不会争用缓存行
+ * 
+ * @return int 分片下标
+ */
+static inline int stat_shard() {
+    if (shard_id < 0) {
+        shard_id = __atomic_fetch_add(&shard_next, 1, __ATOMIC_RELAXED) % CONFIG_STAT_SHARDS;
+    }
+    return shard_id;
+}
+/**
+ * @brief 将虚拟时间推进到不早于to
+ * 
+ * @param clock 分片的device_us，超过CONFIG_STAT_SHARDS个线程时可能共享
+ * @param to 
+ */
+static void clock_advance(long long *clock, long long to) {
+    long long cur = __atomic_load_n(clock, __ATOMIC_RELAXED);
+
+    while (cur < to && 
+           !__atomic_compare_exchange_n(clock, &cur, to, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+/**
+ * @brief 模拟一次设备开销：计入设备时间，再按延迟模式睡眠、忙等或直接返回；
+ * 条带设备本身不计开销，由各成员分别模拟
+ *
+ * 虚拟时间按线程记在各自的分片中，同一线程的请求依次累加，不同线程相互重叠，
+ * 与睡眠方式下的墙上时间一致。异步请求的开销交给queue_worker按通道排布，
+ * 收割时提交者的虚拟时间推进到其完成时间，见ddriver_reap
+ * 
+ * @param us 模拟开销
+ * @return long long 模拟开销
+ */
+long long emulate_delay(struct ddriver *disk, long long us) {
+    long long until;
+
+    if (us <= 0 || disk->stripe != NULL) {
+        return 0;
+    }
+    if (delay_sink != NULL)
+        *delay_sink += us;
+    else
+        __atomic_fetch_add(&SHARD(disk)->device_us, us, __ATOMIC_RELAXED);   /* Max taken in device_clock */
+    switch (disk->delay_mode)
+    {
+    case DDRIVER_DELAY_SPIN:                          /* usleep overshoots short waits */
+        until = now_us() + us;
+        while (now_us() < until)
+            ;
+        break;
+    case DDRIVER_DELAY_VIRTUAL:
+        break;
+    default:
+        usleep(us);
+        break;
+    }
+    return us;
+}
+/**
+ * @brief 后端丢弃，文件打洞使其重新变为稀疏，读出为0；
+ * 文件系统不支持打洞时退化为写0，内核后端转交内核ddriver清零，条带后端拆分到各成员
+ * 
+ * @param fd 
+ * @param offset 
+ * @param size 
+ * @return int 0成功，否则-errno
+ */
+int backend_discard(struct ddriver *disk, off_t offset, long long size) {
+    struct ddriver_range range = { .offset = offset, .size = size };
+    char buf[4096] = {0};
+    long long i, n;
+
+    if (disk->backend == DDRIVER_BACKEND_STRIPE) {
+        return stripe_discard(disk, offset, size);
+    }
+    if (disk->backend == DDRIVER_BACKEND_KERNEL) {
+        if (ioctl(disk->ddriver_fd, IOC_REQ_DEVICE_DISCARD, &range) < 0) {
+            user_panic("discard error: %s", strerror(errno));
+            return -errno;
+        }
+        return 0;
+    }
+    if (fallocate(disk->ddriver_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, size) == 0) {
+        return 0;                                    /* Mapped pages are dropped as well */
+    }
+    if (errno != EOPNOTSUPP) {
+        user_panic("discard error: %s", strerror(errno));
+        return -errno;
+    }
+    if (disk->map != NULL) {
+        memset(disk->map + offset, 0, size);
+        return 0;
+    }
+    for (i = 0; i < size; i += n) {
+        n = size - i < (long long)sizeof(buf) ? size - i : (long long)sizeof(buf);
+        if (pwrite(disk->ddriver_fd, buf, n, offset + i) != n) {
+            user_panic("discard error: %s", strerror(errno));
+            return -errno;
+        }
+    }
+    return 0;
+}
+long long emulate_rotate(struct ddriver *disk, off_t start, off_t end) {
+    long long bytes_per_track = disk->layout_size / disk->track_num;
+    long long lat_per_track = disk->seek_lat;
+    long long distance = llabs(end - start) % bytes_per_track; 
+    
+    if (distance == 0) {
+        return 0;
+    }
+
+    return emulate_delay(disk, distance * lat_per_track / bytes_per_track);
+}
+/**
+ * @brief 校验磁盘配置，容量须为IO单位的整数倍
+ * 
+ * @param cfg 
+ * @return int 0合法，否则-EINVAL
+ */
+int check_valid_config(struct ddriver_config *cfg) {
+    if (cfg->iounit_size != 512 && cfg->iounit_size != 4096) {
+        user_panic("io unit %d should be 512 or 4096", cfg->iounit_size);
+        return -EINVAL;
+    }
+    if (cfg->capacity <= 0 || cfg->capacity > CONFIG_MAX_DISK_SZ ||
+        cfg->capacity % cfg->iounit_size != 0) {
+        user_panic("capacity %lld should be a multiple of %d, at most %lld", 
+                   cfg->capacity, cfg->iounit_size, CONFIG_MAX_DISK_SZ);
+        return -EINVAL;
+    }
+    if (cfg->track_num <= 0 || cfg->track_num > cfg->capacity / cfg->iounit_size) {
+        user_panic("track number %d out of range", cfg->track_num);
+        return -EINVAL;
+    }
+    if (cfg->read_lat < 0 || cfg->write_lat < 0 || 
+        cfg->seek_lat < 0 || cfg->xfer_lat < 0) {
+        user_panic("latency should not be negative");
+        return -EINVAL;
+    }
+    return 0;
+}
+/**
+ * @brief 读取镜像末尾的配置，镜像大小须恰为容量加上尾部
+ * 
+ * @param fd 
+ * @param cfg 
+ * @return int 0成功，-ENOENT表示没有合法的配置(旧镜像或新镜像)
+ */
+int header_load(int fd, struct ddriver_config *cfg) {
+    struct ddriver_header hdr;
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 || st.st_size < CONFIG_HDR_SZ) {
+        return -ENOENT;
+    }
+    if (pread(fd, &hdr, sizeof(hdr), st.st_size - CONFIG_HDR_SZ) != sizeof(hdr)) {
+        return -ENOENT;
+    }
+    if (hdr.magic != CONFIG_HDR_MAGIC || hdr.version != CONFIG_HDR_VERSION ||
+        hdr.config.capacity != st.st_size - CONFIG_HDR_SZ) {
+        return -ENOENT;
+    }
+    if (check_valid_config(&hdr.config) < 0) {
+        return -ENOENT;
+    }
+    *cfg = hdr.config;
+    return 0;
+}
+/**
+ * @brief 按配置调整镜像大小，并把配置写到容量之后的尾部
+ * 
+ * @param fd 
+ * @param cfg 
+ * @return int 
+ */
+int header_store(int fd, struct ddriver_config *cfg) {
+    char buf[CONFIG_HDR_SZ] = {0};
+    struct ddriver_header *hdr = (struct ddriver_header *)buf;
+
+    hdr->magic   = CONFIG_HDR_MAGIC;
+    hdr->version = CONFIG_HDR_VERSION;
+    hdr->config  = *cfg;
+    if (ftruncate(fd, cfg->capacity + CONFIG_HDR_SZ) < 0) {  /* Sparse, blocks allocated on write */
+        return -errno;
+    }
+    if (pwrite(fd, buf, CONFIG_HDR_SZ, cfg->capacity) != CONFIG_HDR_SZ) {
+        return -errno;
+    }
+    return 0;
+}
+/**
+ * @brief 记录一次寻道的距离
+ * 
+ * @param from 
+ * @param to 
+ */
+void account_seek(struct ddriver *disk, off_t from, off_t to) {
+    INC_SEEKCNT(disk);
+    STAT_ADD(seek_cnt, 1);
+    STAT_ADD(seek_dist, from > to ? from - to : to - from);
+}
+/**
+ * @brief 记录一次读写：字节数、模拟延迟的log2直方图，以及按LBA区域划分的热度，
+ * 追踪打开时同时追加追踪记录
+ * 
+ * @param op DDRIVER_OP_READ / DDRIVER_OP_WRITE
+ * @param offset 
+ * @param size 
+ * @param lat 本次请求的模拟延迟(us)
+ */
+void account_io(struct ddriver *disk, int op, off_t offset, size_t size, long long lat) {
+    struct ddriver_shard *shard = SHARD(disk);
+    struct ddriver_op_stat *stat = &shard->stats.op[op];
+    long long region_sz = disk->region_sz;
+    long long end = offset + size;
+    long long cur, next;
+    int bucket = lat > 0 ? 64 - __builtin_clzll(lat) : 0;
+
+    if (bucket >= DDRIVER_HIST_NR) {
+        bucket = DDRIVER_HIST_NR - 1;
+    }
+    __atomic_fetch_add(&stat->cnt, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stat->bytes, size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stat->lat_us, lat, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stat->hist[bucket], 1, __ATOMIC_RELAXED);
+    for (cur = offset; cur < end; cur = next) {
+        next = (cur / region_sz + 1) * region_sz;
+        if (next > end) {
+            next = end;
+        }
+        __atomic_fetch_add(&shard->stats.heat[op][cur / region_sz], next - cur, __ATOMIC_RELAXED);
+    }
+    trace_record(&disk->trace, op, offset, size);
+}
+/**
+ * @brief 将缓冲的追踪记录写入追踪文件，调用者持有trace->lock
+ */
+void trace_flush_locked(struct ddriver_trace *trace) {
+    if (trace->file == NULL || trace->nr == 0) {
+        return;
+    }
+    fwrite(trace->recs, sizeof(struct ddriver_trace_rec), trace->nr, trace->file);
+    fflush(trace->file);
+    trace->nr = 0;
+}
+/**
+ * @brief 追加一条追踪记录，缓冲区满时写入追踪文件
+ * 
+ * @param op 
+ * @param offset 
+ * @param size 
+ */
+void trace_record(struct ddriver_trace *trace, int op, off_t offset, size_t size) {
+    struct ddriver_trace_rec *rec;
+
+    if (__atomic_load_n(&trace->file, __ATOMIC_ACQUIRE) == NULL) {   /* Tracing off: no lock per IO */
+        return;
+    }
+    pthread_mutex_lock(&trace->lock);
+    if (trace->file != NULL) {
+        rec = &trace->recs[trace->nr++];
+        rec->ts_us  = now_us() - trace->start_us;
+        rec->offset = offset;
+        rec->size   = size;
+        rec->op     = op;
+        rec->tag    = trace_tag;
+        if (trace->nr == CONFIG_TRACE_NR) {
+            trace_flush_locked(trace);
+        }
+    }
+    pthread_mutex_unlock(&trace->lock);
+}
+/**
+ * @brief 开始追踪，文件头记录设备几何参数
+ * 
+ * @param path 追踪文件
+ * @return int 
+ */
+int trace_open(struct ddriver *disk, char *path) {
+    struct ddriver_trace_hdr hdr = {
+        .magic       = DDRIVER_TRACE_MAGIC,
+        .version     = DDRIVER_TRACE_VERSION,
+        .iounit_size = disk->iounit_size,
+        .capacity    = disk->layout_size
+    };
+
+    struct ddriver_trace *trace = &disk->trace;
+    struct ddriver_trace_rec *recs;
+    FILE *file;
+
+    file = fopen(path, "w");
+    if (file == NULL) {
+        user_panic("can't open trace: %s", path);
+        return -errno;
+    }
+    recs = (struct ddriver_trace_rec *)malloc(CONFIG_TRACE_NR * sizeof(struct ddriver_trace_rec));
+    if (recs == NULL) {
+        fclose(file);
+        return -ENOMEM;
+    }
+    fwrite(&hdr, sizeof(hdr), 1, file);
+    pthread_mutex_lock(&trace->lock);
+    trace->recs = recs;
+    trace->nr = 0;
+    trace->start_us = now_us();
+    __atomic_store_n(&trace->file, file, __ATOMIC_RELEASE);   /* Published last, see trace_record */
+    pthread_mutex_unlock(&trace->lock);
+    return 0;
+}
+/**
+ * @brief 结束追踪，写出剩余记录
+ */
+void trace_close(struct ddriver_trace *trace) {
+    pthread_mutex_lock(&trace->lock);
+    if (trace->file != NULL) {
+        trace_flush_locked(trace);
+        fclose(trace->file);
+        __atomic_store_n(&trace->file, NULL, __ATOMIC_RELEASE);
+        free(trace->recs);
+        trace->recs = NULL;
+    }
+    pthread_mutex_unlock(&trace->lock);
+}
+/**
+ * @brief 清空扩展统计，热度区域按容量均分并对齐到IO单位
+ */
+void stats_reset(struct ddriver *disk) {
+    long long units = disk->layout_size / disk->iounit_size;
+
+    memset(disk->shards, 0, CONFIG_STAT_SHARDS * sizeof(struct ddriver_shard));
+    disk->region_sz = (units + DDRIVER_HEAT_NR - 1) / DDRIVER_HEAT_NR * disk->iounit_size;
+}
+/**
+ * @brief 汇总所有分片。与IO并发时各计数器各自精确，但彼此不是同一时刻的快照
+ * 
+ * @param state 读写寻道次数，可为NULL
+ * @param stats 扩展统计，可为NULL
+ */
+void stats_collect(struct ddriver *disk, struct ddriver_state *state, struct ddriver_stats *stats) {
+    struct ddriver_shard *shard;
+    long long *src, *dst;
+    int i, j, n = sizeof(struct ddriver_stats) / sizeof(long long);
+
+    if (state != NULL) {
+        memset(state, 0, sizeof(struct ddriver_state));
+    }
+    if (stats != NULL) {
+        memset(stats, 0, sizeof(struct ddriver_stats));
+    }
+    for (i = 0; i < CONFIG_STAT_SHARDS; i++) {
+        shard = &disk->shards[i];
+        if (state != NULL) {
+            state->read_cnt  += __atomic_load_n(&shard->read_cnt, __ATOMIC_RELAXED);
+            state->write_cnt += __atomic_load_n(&shard->write_cnt, __ATOMIC_RELAXED);
+            state->seek_cnt  += __atomic_load_n(&shard->seek_cnt, __ATOMIC_RELAXED);
+        }
+        if (stats != NULL) {
+            src = (long long *)&shard->stats;        /* ddriver_stats only holds long long */
+            dst = (long long *)stats;
+            for (j = 0; j < n; j++) {
+                dst[j] += __atomic_load_n(&src[j], __ATOMIC_RELAXED);
+            }
+        }
+    }
+    if (stats != NULL) {
+        stats->region_sz = disk->region_sz;
+    }
+}
+long long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+/**
+ * @brief C-SCAN: 取不小于当前磁头位置的最小偏移，没有则回绕到最小偏移
+ * 
+ * @return int pending中的下标
+ */
+int sched_pick_cscan(struct ddriver_queue *queue) {
+    int i, ahead = -1, lowest = 0;
+    off_t ofs;
+
+    for (i = 0; i < queue->nr_pending; i++) {
+        ofs = queue->pending[i].req->offset;
+        if (ofs < queue->pending[lowest].req->offset) {
+            lowest = i;
+        }
+        if (ofs >= queue->sched_head && 
+            (ahead < 0 || ofs < queue->pending[ahead].req->offset)) {
+            ahead = i;
+        }
+    }
+    return ahead >= 0 ? ahead : lowest;
+}
+/**
+ * @brief Deadline: 每种操作最老的请求中有超时的，先服务其中提交最早的，否则按C-SCAN顺序
+ *
+ * pending按提交顺序排列，各操作第一次出现的即其最老的请求，
+ * 如此写请求较长的期限不会挡住已超时的读请求
+ * @return int pending中的下标
+ */
+int sched_pick_deadline(struct ddriver_queue *queue) {
+    struct ddriver_iocb *iocb;
+    long long now = now_us(), expire;
+    int oldest[DDRIVER_OP_NR];
+    int i, op, seen = 0, pick = -1;
+
+    for (op = 0; op < DDRIVER_OP_NR; op++) {
+        oldest[op] = -1;
+    }
+    for (i = 0; i < queue->nr_pending && seen < DDRIVER_OP_NR; i++) {
+        op = queue->pending[i].req->op == DDRIVER_OP_WRITE ? DDRIVER_OP_WRITE : DDRIVER_OP_READ;
+        if (oldest[op] < 0) {
+            oldest[op] = i;
+            seen++;
+        }
+    }
+    for (op = 0; op < DDRIVER_OP_NR; op++) {
+        if (oldest[op] < 0) {
+            continue;
+        }
+        iocb   = &queue->pending[oldest[op]];
+        expire = op == DDRIVER_OP_WRITE ? CONFIG_WRITE_EXPIRE_US : CONFIG_READ_EXPIRE_US;
+        if (now - iocb->submit_us >= expire && (pick < 0 || oldest[op] < pick)) {
+            pick = oldest[op];
+        }
+    }
+    return pick >= 0 ? pick : sched_pick_cscan(queue);
+}
+/**
+ * @brief 从pending中按调度策略取出一个请求，调用者持有queue->lock
+ * 
+ * @param iocb 
+ */
+void sched_dispatch(struct ddriver_queue *queue, struct ddriver_iocb *iocb) {
+    struct ddriver_sched_stat *stat = &queue->stat[queue->policy];
+    int   idx;
+    off_t ofs;
+
+    switch (queue->policy)
+    {
+    case DDRIVER_SCHED_DEADLINE:
+        idx = sched_pick_deadline(queue);
+        break;
+    case DDRIVER_SCHED_CSCAN:
+        idx = sched_pick_cscan(queue);
+        break;
+    default:
+        idx = 0;
+        break;
+    }
+    *iocb = queue->pending[idx];
+    queue->nr_pending--;
+    memmove(&queue->pending[idx], &queue->pending[idx + 1], 
+            (queue->nr_pending - idx) * sizeof(struct ddriver_iocb));
+
+    ofs = iocb->req->offset;
+    if (ofs != queue->sched_head) {
+        stat->seek_cnt++;
+        stat->seek_dist += ofs > queue->sched_head ? ofs - queue->sched_head 
+                                                   : queue->sched_head - ofs;
+    }
+    queue->sched_head = ofs + iocb->req->size;
+    stat->dispatch_cnt++;
+}
+/**
+ * @brief 异步队列工作线程，每个线程独立承担一次请求的模拟延迟，
+ * 因此在途请求的延迟可以相互重叠
+ *
+ * 虚拟时钟上，每个工作线程对应一条通道，请求派发到最早空闲的通道，
+ * 从提交时间与通道空闲时间中较晚的开始。虚拟方式不真实等待，
+ * 一个线程可能连续取走全部请求，因此按通道而不是按线程排布
+ * 
+ * @param arg 所属设备
+ * @return void* 
+ */
+void* queue_worker(void *arg) {
+    struct ddriver *disk = (struct ddriver *)arg;
+    struct ddriver_queue *queue = &disk->queue;
+    struct ddriver_iocb iocb;
+    struct ddriver_req *req;
+    struct ddriver_sched_stat *stat;
+    long long lat, start, cost;
+    int lane, i;
+    
+    while (1) {
+        pthread_mutex_lock(&queue->lock);
+        while (!queue->stop && queue->nr_pending == 0) {
+            pthread_cond_wait(&queue->sq_cond, &queue->lock);
+        }
+        if (queue->nr_pending == 0) {                 /* stop and drained */
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+        sched_dispatch(queue, &iocb);
+        stat = &queue->stat[queue->policy];
+        for (lane = 0, i = 1; i < queue->nr_workers; i++) {   /* Earliest free, busy are LLONG_MAX */
+            lane = queue->lane_vus[i] < queue->lane_vus[lane] ? i : lane;
+        }
+        start = queue->lane_vus[lane] > iocb.submit_vus ? queue->lane_vus[lane] : iocb.submit_vus;
+        queue->lane_vus[lane] = LLONG_MAX;
+        pthread_mutex_unlock(&queue->lock);
+
+        req = iocb.req;
+        trace_tag = iocb.tag;
+        cost = 0;
+        delay_sink = &cost;
+        if (req->op == DDRIVER_OP_WRITE)
+            req->res = ddriver_pwrite(disk->ddriver_fd, req->buf, req->size, req->offset);
+        else if (req->op == DDRIVER_OP_READ)
+            req->res = ddriver_pread(disk->ddriver_fd, req->buf, req->size, req->offset);
+        else
+            req->res = -EINVAL;
+        delay_sink = NULL;
+        lat = now_us() - iocb.submit_us;
+        clock_advance(&SHARD(disk)->device_us, start + cost);   /* Seen by device_clock */
+
+        pthread_mutex_lock(&queue->lock);
+        stat->lat_us += lat;
+        if (lat > stat->max_lat_us) {
+            stat->max_lat_us = lat;
+        }
+        queue->done[(queue->cq_head + queue->nr_done) % CONFIG_MAX_QD] = req;
+        queue->done_vus[(queue->cq_head + queue->nr_done) % CONFIG_MAX_QD] = start + cost;
+        queue->lane_vus[lane] = start + cost;
+        queue->nr_done++;
+        pthread_cond_broadcast(&queue->cq_cond);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    return NULL;
+}
+/**
+ * @brief 按配置设置磁盘几何参数与延迟
+ * 
+ * @param cfg 
+ */
+void config_apply(struct ddriver *disk, struct ddriver_config *cfg) {
+    disk->layout_size = cfg->capacity;
+    disk->iounit_size = cfg->iounit_size;
+    disk->track_num   = cfg->track_num;
+    disk->read_lat    = cfg->read_lat;
+    disk->write_lat   = cfg->write_lat;
+    disk->seek_lat    = cfg->seek_lat;
+    disk->xfer_lat    = cfg->xfer_lat;
+}
+/**
+ * @brief 打开用户态磁盘镜像，按需扩容并写入配置尾部
+ * 
+ * @param path 
+ * @param cfg 
+ * @return int 文件描述符
+ */
+int image_open(struct ddriver *disk, char *path, struct ddriver_config *cfg) {
+    int fd, ret = 0;
+    char *backend;
+    struct stat st;
+    struct ddriver_config conf = DDRIVER_CONFIG_DEFAULT;
+    struct ddriver_config saved;
+    long long held = 0;                               /* Bytes of data already in the image */
+    ssize_t size;
+    char zeros[CONFIG_HDR_SZ] = {0};
+
+    if (access(path, F_OK) == 0) {
+        fd = open(path, O_RDWR);
+    }
+    else {
+        fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    }
+    if (fd < 0) {
+        user_panic("can't open device: %d", fd);
+        return fd;
+    }
+    if (header_load(fd, &saved) == 0) {
+        conf = saved;
+        held = saved.capacity;
+    }
+    else if (fstat(fd, &st) == 0 && st.st_size > 0 &&     /* Image without trailer */
+             st.st_size % conf.iounit_size == 0 && st.st_size <= CONFIG_MAX_DISK_SZ) {
+        saved.capacity = -1;
+        conf.capacity = st.st_size;
+        held = st.st_size;
+    }
+    else {
+        saved.capacity = -1;
+        held = fstat(fd, &st) == 0 ? st.st_size : 0;
+    }
+    if (cfg != NULL) {
+        conf = *cfg;
+    }
+    ret = check_valid_config(&conf);
+    if (ret < 0) {
+        close(fd);
+        return ret;
+    }
+    if (held > conf.capacity) {                       /* header_store would truncate the data */
+        user_panic("capacity %lld smaller than the image's %lld", conf.capacity, held);
+        close(fd);
+        return -EINVAL;
+    }
+    if (saved.capacity >= 0 && saved.capacity < conf.capacity) {   /* Old trailer becomes data */
+        size = conf.capacity - saved.capacity < CONFIG_HDR_SZ ? 
+               conf.capacity - saved.capacity : CONFIG_HDR_SZ;
+        ret = pwrite(fd, zeros, size, saved.capacity);
+        if (ret != size) {                            /* Short write leaves trailer bytes in data */
+            ret = ret < 0 ? -errno : -EIO;
+            user_panic("can't clear old trailer");
+            close(fd);
+            return ret;
+        }
+    }
+    ret = header_store(fd, &conf);
+    if (ret < 0) {
+        user_panic("low space");
+        close(fd);
+        return ret;
+    }
+    config_apply(disk, &conf);
+
+    backend = getenv(DDRIVER_BACKEND_ENV);
+    disk->backend = DDRIVER_BACKEND_FILE;
+    if (backend != NULL && strcmp(backend, "mmap") == 0) {
+        disk->map = mmap(NULL, disk->layout_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (disk->map == MAP_FAILED) {
+            user_panic("can't map device: %s", strerror(errno));
+            disk->map = NULL;
+            close(fd);
+            return -1;
+        }
+        disk->backend = DDRIVER_BACKEND_MMAP;
+    }
+    return fd;
+}
+/**
+ * @brief 打开内核ddriver字符设备，容量与IO单位取自内核，整个磁盘映射到内存，
+ * 读写直接拷贝，不再经过copy_to_user
+ * 
+ * @param path 如/dev/ddriver
+ * @param cfg 只取其中的延迟参数
+ * @return int 文件描述符
+ */
+int kernel_open(struct ddriver *disk, char *path, struct ddriver_config *cfg) {
+    struct ddriver_config conf = DDRIVER_CONFIG_DEFAULT;
+    int fd, size, ret;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0) {
+        user_panic("can't open device: %s", strerror(errno));
+        return -errno;
+    }
+    if (cfg != NULL) {
+        conf = *cfg;
+    }
+    if (ioctl(fd, IOC_REQ_DEVICE_SIZE, &size) < 0 || 
+        ioctl(fd, IOC_REQ_DEVICE_IO_SZ, &conf.iounit_size) < 0) {
+        user_panic("not a ddriver device: %s", path);
+        close(fd);
+        return -ENODEV;
+    }
+    conf.capacity = size;
+    ret = check_valid_config(&conf);
+    if (ret < 0) {
+        close(fd);
+        return ret;
+    }
+    config_apply(disk, &conf);
+
+    disk->map = mmap(NULL, disk->layout_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (disk->map == MAP_FAILED) {
+        user_panic("can't map device: %s", strerror(errno));
+        disk->map = NULL;
+        close(fd);
+        return -1;
+    }
+    disk->backend = DDRIVER_BACKEND_KERNEL;
+    return fd;
+}
+/**
+ * @brief 按fd查找已打开的设备
+ * 
+ * @param fd 
+ * @return struct ddriver* 未打开时为NULL
+ */
+struct ddriver* device_get(int fd) {
+    struct ddriver *disk = NULL;
+
+    if (fd >= 0 && fd < CONFIG_MAX_FD) {
+        disk = __atomic_load_n(&devices[fd], __ATOMIC_ACQUIRE);
+    }
+    if (disk == NULL) {
+        user_panic("fd %d is not an open ddriver device", fd);
+    }
+    return disk;
+}
+/**
+ * @brief 分配设备状态，几何参数与延迟取默认值，之后由打开过程覆盖
+ * 
+ * @return struct ddriver* 
+ */
+struct ddriver* device_alloc() {
+    struct ddriver *disk = (struct ddriver *)malloc(sizeof(struct ddriver));
+
+    if (disk == NULL) {
+        return NULL;
+    }
+    memcpy(disk, &disk_default, sizeof(struct ddriver));
+    disk->shards = (struct ddriver_shard *)aligned_alloc(CONFIG_CACHELINE,
+                                                         CONFIG_STAT_SHARDS * sizeof(struct ddriver_shard));
+    if (disk->shards == NULL) {
+        free(disk);
+        return NULL;
+    }
+    memset(disk->shards, 0, CONFIG_STAT_SHARDS * sizeof(struct ddriver_shard));
+    pthread_mutex_init(&disk->queue.lock, NULL);
+    pthread_cond_init(&disk->queue.sq_cond, NULL);
+    pthread_cond_init(&disk->queue.cq_cond, NULL);
+    pthread_mutex_init(&disk->trace.lock, NULL);
+    return disk;
+}
+
+void device_free(struct ddriver *disk) {
+    pthread_mutex_destroy(&disk->queue.lock);
+    pthread_cond_destroy(&disk->queue.sq_cond);
+    pthread_cond_destroy(&disk->queue.cq_cond);
+    pthread_mutex_destroy(&disk->trace.lock);
+    free(disk->shards);
+    free(disk);
+}
+/**
+ * @brief 已有设备在追踪时，新设备的追踪文件加上.fd后缀，避免相互覆盖
+ * 
+ * @param disk 
+ * @param path DDRIVER_TRACE
+ * @return int 
+ */
+int device_trace_open(struct ddriver *disk, char *path) {
+    char trace_path[PATH_MAX + 16] = {0};
+    int  i, busy = 0;
+
+    pthread_mutex_lock(&devices_lock);
+    for (i = 0; i < CONFIG_MAX_FD; i++) {
+        if (devices[i] != NULL && devices[i]->trace.file != NULL) {
+            busy = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&devices_lock);
+    if (busy) {
+        snprintf(trace_path, sizeof(trace_path), "%s.%d", path, disk->ddriver_fd);
+    }
+    else {
+        snprintf(trace_path, sizeof(trace_path), "%s", path);
+    }
+    return trace_open(disk, trace_path);
+}
+/**
+ * @brief 打开后的公共初始化：读取DDRIVER_CLOCK，清零计数，打开日志与追踪，登记到设备表
+ * 
+ * @param disk 
+ * @param fd 
+ * @param path 
+ * @param log_path 
+ * @return int 文件描述符，失败时为负数，调用者负责释放后端
+ */
+int device_register(struct ddriver *disk, int fd, char *path, char *log_path) {
+    char *clock;
+    char *trace_path;
+
+    if (fd >= CONFIG_MAX_FD) {
+        user_panic("fd %d exceeds %d", fd, CONFIG_MAX_FD);
+        return -EMFILE;
+    }
+    disk->ddriver_fd = fd;
+    snprintf(disk->path, sizeof(disk->path), "%s", path);
+    clock = getenv(DDRIVER_CLOCK_ENV);
+    if (clock != NULL && strcmp(clock, "virtual") == 0) {
+        disk->delay_mode = DDRIVER_DELAY_VIRTUAL;
+    }
+    else if (clock != NULL && strcmp(clock, "spin") == 0) {
+        disk->delay_mode = DDRIVER_DELAY_SPIN;
+    }
+    disk->pos = 0;
+    SET_HEAD(disk, 0);
+    disk->open_us = now_us();
+    stats_reset(disk);                                /* Also zeroes the device clock */
+
+    disk->debugf = fopen(log_path, "w+");
+    if (disk->debugf == NULL) {
+        user_panic("can't init log: %s", log_path);
+        return -1;
+    }
+
+    trace_path = getenv(DDRIVER_TRACE_ENV);
+    if (trace_path != NULL && trace_path[0] != '\0') {
+        device_trace_open(disk, trace_path);
+    }
+
+    pthread_mutex_lock(&devices_lock);
+    __atomic_store_n(&devices[fd], disk, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&devices_lock);
+    return fd;
+}
+/**
+ * @brief 单个设备的时钟，各分片虚拟时间中最晚的，即服务完全部请求的时间
+ * 
+ * @param disk 
+ * @return long long 
+ */
+static long long shards_clock(struct ddriver *disk) {
+    long long clock = 0, us;
+    int i;
+
+    for (i = 0; i < CONFIG_STAT_SHARDS; i++) {
+        us = __atomic_load_n(&disk->shards[i].device_us, __ATOMIC_RELAXED);
+        clock = us > clock ? us : clock;
+    }
+    return clock;
+}
+/**
+ * @brief 设备时钟，条带设备取各成员中最忙的一个，即并行服务所需的时间
+ * 
+ * @param disk 
+ * @return long long 
+ */
+long long device_clock(struct ddriver *disk) {
+    struct ddriver *member;
+    long long clock = shards_clock(disk);
+    long long us;
+    int i;
+
+    if (disk->stripe == NULL) {
+        return clock;
+    }
+    for (i = 0; i < disk->stripe->nr; i++) {
+        member = device_get(disk->stripe->lanes[i].fd);
+        us = shards_clock(member);
+        clock = us > clock ? us : clock;
+    }
+    return clock;
+}
+/**
+ * @brief 条带成员的工作线程，按提交顺序逐个服务子请求，
+ * 不同成员的工作线程相互并行，延迟相互重叠
+ * 
+ * @param arg 所属的stripe_lane
+ * @return void* 
+ */
+void* stripe_worker(void *arg) {
+    struct stripe_lane *lane = (struct stripe_lane *)arg;
+    struct stripe_job  *job;
+    int res;
+
+    while (1) {
+        pthread_mutex_lock(&lane->lock);
+        while (!lane->stop && lane->head == NULL) {
+            pthread_cond_wait(&lane->cond, &lane->lock);
+        }
+        job = lane->head;
+        if (job == NULL) {                            /* stop and drained */
+            pthread_mutex_unlock(&lane->lock);
+            break;
+        }
+        lane->head = job->next;
+        if (lane->head == NULL) {
+            lane->tail = NULL;
+        }
+        pthread_mutex_unlock(&lane->lock);
+
+        if (job->op == DDRIVER_OP_WRITE)
+            res = ddriver_pwrite(lane->fd, job->buf, job->size, job->offset);
+        else
+            res = ddriver_pread(lane->fd, job->buf, job->size, job->offset);
+
+        pthread_mutex_lock(&job->wait->lock);
+        if (res < 0 && job->wait->res == 0) {
+            job->wait->res = res;
+        }
+        if (--job->wait->pending == 0) {
+            pthread_cond_signal(&job->wait->cond);
+        }
+        pthread_mutex_unlock(&job->wait->lock);
+    }
+    return NULL;
+}
+/**
+ * @brief 逻辑偏移映射到成员：第k个条带单元位于成员k % nr的第k / nr个单元
+ * 
+ * @param stripe 
+ * @param offset 逻辑偏移
+ * @param member 输出成员下标
+ * @param len 输出本单元内剩余的字节数
+ * @return off_t 成员上的偏移
+ */
+off_t stripe_map(struct ddriver_stripe *stripe, off_t offset, int *member, size_t *len) {
+    off_t unit_no = offset / stripe->unit;
+    off_t in_unit = offset % stripe->unit;
+
+    *member = unit_no % stripe->nr;
+    *len    = stripe->unit - in_unit;
+    return (unit_no / stripe->nr) * stripe->unit + in_unit;
+}
+/**
+ * @brief 条带读写：按条带单元拆分为子请求，交给各成员的工作线程并行服务后等待全部完成
+ * 
+ * @param disk 
+ * @param op DDRIVER_OP_READ / DDRIVER_OP_WRITE
+ * @param iov 
+ * @param iovcnt 
+ * @param offset 逻辑偏移
+ * @return ssize_t 读写的字节数，负数为-errno
+ */
+ssize_t stripe_rw(struct ddriver *disk, int op, const struct iovec *iov, int iovcnt, off_t offset) {
+    struct ddriver_stripe *stripe = disk->stripe;
+    struct stripe_wait wait = { .pending = 0, .res = 0 };
+    struct stripe_job  *jobs, *job;
+    struct stripe_lane *lane;
+    size_t total = 0, done, len;
+    int    i, nr_jobs = 0;
+
+    for (i = 0; i < iovcnt; i++) {
+        nr_jobs += iov[i].iov_len / stripe->unit + 2;
+    }
+    jobs = (struct stripe_job *)malloc(nr_jobs * sizeof(struct stripe_job));
+    if (jobs == NULL) {
+        return -ENOMEM;
+    }
+    nr_jobs = 0;
+    for (i = 0; i < iovcnt; i++) {
+        for (done = 0; done < iov[i].iov_len; done += len) {
+            job = &jobs[nr_jobs++];
+            job->offset = stripe_map(stripe, offset + total + done, &job->lane, &len);
+            len         = len < iov[i].iov_len - done ? len : iov[i].iov_len - done;
+            job->op     = op;
+            job->buf    = (char *)iov[i].iov_base + done;
+            job->size   = len;
+            job->wait   = &wait;
+            job->next   = NULL;
+        }
+        total += iov[i].iov_len;
+    }
 
-#define INC_READCNT(disk)       (disk.read_cnt++)
-#define INC_WRITECNT(disk)      (disk.write_cnt++)
-#define INC_SEEKCNT(disk)       (disk.seek_cnt++)
+    pthread_mutex_init(&wait.lock, NULL);
+    pthread_cond_init(&wait.cond, NULL);
+    wait.pending = nr_jobs;                           /* Set before any job can finish */
+    for (i = 0; i < nr_jobs; i++) {
+        job  = &jobs[i];
+        lane = &stripe->lanes[job->lane];
+        pthread_mutex_lock(&lane->lock);
+        if (lane->tail != NULL)
+            lane->tail->next = job;
+        else
+            lane->head = job;
+        lane->tail = job;
+        pthread_cond_signal(&lane->cond);
+        pthread_mutex_unlock(&lane->lock);
+    }
 
-#define RW_DELAY(disk, rw_ops)  (usleep(disk.rw_ops##_lat * 1000))
-/******************************************************************************
-* SECTION: Type definitions
-*******************************************************************************/
-struct ddriver
-{
-    int  ddriver_fd;                                 /* Disk ddriver_fd */
-    int  read_cnt;
-    int  write_cnt;
-    int  seek_cnt;
-    int  read_lat;
-    int  write_lat;
-    int  seek_lat;
-    int  track_num;
-    int  major_num;
-    int  layout_size;
-    int  iounit_size;
-};
-/******************************************************************************
-* SECTION: Global Variable
-*******************************************************************************/
-/* reference: https://en.wikipedia.org/wiki/Hard_disk_drive_performance_characteristics */
-struct ddriver disk = {
-    .read_cnt    = 0,
-    .write_cnt   = 0,
-    .seek_cnt    = 0,
-    .read_lat    = 2,       /* 2ms */       
-    .write_lat   = 1,       /* 1ms */
-    .seek_lat    = 4,       /* 4.17ms per 360 degree */
-    .major_num   = 0,
-    .track_num   = 100,
-    .layout_size = CONFIG_DISK_SZ,
-    .iounit_size = CONFIG_BLOCK_SZ
-};
+    pthread_mutex_lock(&wait.lock);
+    while (wait.pending > 0) {
+        pthread_cond_wait(&wait.cond, &wait.lock);
+    }
+    pthread_mutex_unlock(&wait.lock);
+    pthread_mutex_destroy(&wait.lock);
+    pthread_cond_destroy(&wait.cond);
+    free(jobs);
+    return wait.res < 0 ? wait.res : (ssize_t)total;
+}
+/**
+ * @brief 条带丢弃，逐个条带单元转交成员丢弃
+ * 
+ * @param disk 
+ * @param offset 
+ * @param size 
+ * @return int 
+ */
+int stripe_discard(struct ddriver *disk, off_t offset, long long size) {
+    struct ddriver_range range;
+    long long done;
+    size_t len;
+    int member, ret;
 
-FILE *debugf = NULL;
-/******************************************************************************
-* SECTION: Helper Functions
-*******************************************************************************/
-int check_valid(size_t size) {
-    if (size != CONFIG_BLOCK_SZ){
-        user_alert("io size %ld should align to %d", size, CONFIG_BLOCK_SZ);
-        return -EIO;
+    for (done = 0; done < size; done += len) {
+        range.offset = stripe_map(disk->stripe, offset + done, &member, &len);
+        len          = (long long)len < size - done ? len : size - done;
+        range.size   = len;
+        ret = ddriver_ioctl(disk->stripe->lanes[member].fd, IOC_REQ_DEVICE_DISCARD, &range);
+        if (ret < 0) {
+            return ret;
+        }
     }
     return 0;
 }
+/**
+ * @brief 解析 stripe:<条带单元>:<镜像1>,<镜像2>,... 并打开条带设备
+ * 
+ * @param spec 
+ * @param cfg 
+ * @return int 
+ */
+int stripe_open_spec(char *spec, struct ddriver_config *cfg) {
+    char  buf[PATH_MAX];
+    char  *paths[DDRIVER_STRIPE_MAX];
+    char  *cursor, *save;
+    long  unit;
+    int   nr = 0;
 
-int emulate_rotate(int fd, off_t start, off_t end) {
-    int bytes_per_track = disk.layout_size / disk.track_num;
-    int lat_per_track = disk.seek_lat;
-    int distance = abs(end - start) % bytes_per_track; 
-    
-    if (distance == 0) {
-        return 0;
+    snprintf(buf, sizeof(buf), "%s", spec + strlen(DDRIVER_STRIPE_PREFIX));
+    unit = strtol(buf, &cursor, 10);
+    if (cursor == buf || *cursor != ':') {
+        user_panic("bad stripe spec [%s], should be " DDRIVER_STRIPE_PREFIX "<unit>:<path>,...", spec);
+        return -EINVAL;
+    }
+    for (cursor = strtok_r(cursor + 1, ",", &save); cursor != NULL; 
+         cursor = strtok_r(NULL, ",", &save)) {
+        if (nr == DDRIVER_STRIPE_MAX) {
+            user_panic("stripe over more than %d devices", DDRIVER_STRIPE_MAX);
+            return -EINVAL;
+        }
+        paths[nr++] = cursor;
+    }
+    return ddriver_open_stripe(paths, nr, unit, cfg);
+}
+/**
+ * @brief 向每个成员转发IOCTL，返回第一个错误
+ * 
+ * @param disk 
+ * @param cmd 
+ * @param arg 
+ * @return int 
+ */
+int stripe_ioctl(struct ddriver *disk, unsigned long cmd, void *arg) {
+    int i, ret, res = 0;
+
+    for (i = 0; i < disk->stripe->nr; i++) {
+        ret = ddriver_ioctl(disk->stripe->lanes[i].fd, cmd, arg);
+        if (ret < 0 && res == 0) {
+            res = ret;
+        }
     }
+    return res;
+}
+/**
+ * @brief 停止各成员的工作线程并关闭成员设备
+ * 
+ * @param stripe 
+ * @param nr_workers 已启动的工作线程数
+ */
+void stripe_close(struct ddriver_stripe *stripe, int nr_workers) {
+    struct stripe_lane *lane;
+    int i;
 
-    usleep(distance * lat_per_track / bytes_per_track * 1000);
-    return 0;
+    for (i = 0; i < stripe->nr; i++) {
+        lane = &stripe->lanes[i];
+        if (i < nr_workers) {
+            pthread_mutex_lock(&lane->lock);
+            lane->stop = 1;
+            pthread_cond_signal(&lane->cond);
+            pthread_mutex_unlock(&lane->lock);
+            pthread_join(lane->worker, NULL);
+        }
+        pthread_mutex_destroy(&lane->lock);
+        pthread_cond_destroy(&lane->cond);
+        ddriver_close(lane->fd);
+    }
+    free(stripe);
 }
 /******************************************************************************
 * SECTION: Global Function Implementation
 *******************************************************************************/
 /**
- * @brief 打开驱动
+ * @brief 打开驱动，使用镜像中保存的配置
  * 
  * @return int 文件描述符
  */
 int ddriver_open(char *path) {
-    int fd, ret = 0;
-    char device_path[128] = {0};
-    char log_path[128] = {0};
-    
-    sprintf(device_path, "%s/" DEVICE_NAME, getpwuid(getuid())->pw_dir);
-    sprintf(log_path, "%s/" DEVICE_LOG, getpwuid(getuid())->pw_dir);
+    return ddriver_open_ex(path, NULL);
+}
+/**
+ * @brief 以指定几何参数打开驱动，配置保存在镜像末尾，下次打开时沿用；
+ * cfg为NULL时沿用镜像中的配置，没有则取默认配置。
+ * path可为任意镜像文件，各设备状态按fd相互独立，日志写到镜像路径加_log后缀；
+ * 环境变量DDRIVER_BACKEND=mmap时将整个磁盘映射到内存，读写直接拷贝，不再产生系统调用；
+ * 环境变量DDRIVER_CLOCK=virtual时不再真实等待，只推进虚拟设备时钟(spin为忙等)；
+ * 环境变量DDRIVER_TRACE指定文件时，每个请求追加一条追踪记录；
+ * path为内核ddriver字符设备(如/dev/ddriver)时改用内核后端，通过mmap直接访问；
+ * path形如stripe:<条带单元>:<镜像1>,<镜像2>,...时打开条带设备，见ddriver_open_stripe
+ * 
+ * @param path 
+ * @param cfg 
+ * @return int 文件描述符
+ */
+int ddriver_open_ex(char *path, struct ddriver_config *cfg) {
+    int fd, ret;
+    struct stat st;
+    struct ddriver *disk;
+    char log_path[PATH_MAX + 16] = {0};
     
-    if (strcmp(device_path, path) != 0) {
-        user_panic("wrong path [%s], should be [%s]", path, device_path);
-        return -1;
+    if (path == NULL || strlen(path) >= PATH_MAX) {
+        user_panic("invalid device path");
+        return -EINVAL;
     }
-
-    if (access(device_path, F_OK) == 0) {
-        fd = open(device_path, O_RDWR);
+    if (strncmp(path, DDRIVER_STRIPE_PREFIX, strlen(DDRIVER_STRIPE_PREFIX)) == 0) {
+        return stripe_open_spec(path, cfg);
+    }
+    disk = device_alloc();
+    if (disk == NULL) {
+        user_panic("no memory for device [%s]", path);
+        return -ENOMEM;
+    }
+    if (stat(path, &st) == 0 && S_ISCHR(st.st_mode)) {
+        fd = kernel_open(disk, path, cfg);            /* /dev is not writable, log in home */
+        snprintf(log_path, sizeof(log_path), "%s/%s" DEVICE_LOG, 
+                 getpwuid(getuid())->pw_dir, strrchr(path, '/') ? strrchr(path, '/') + 1 : path);
     }
     else {
-        fd = open(device_path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+        fd = image_open(disk, path, cfg);
+        snprintf(log_path, sizeof(log_path), "%s" DEVICE_LOG, path);
     }
     if (fd < 0) {
-        user_panic("can't open device: %d", fd);
+        device_free(disk);
         return fd;
     }
-    ret = posix_fallocate(fd, 0, CONFIG_DISK_SZ);
+    ret = device_register(disk, fd, path, log_path);
     if (ret < 0) {
-        user_panic("low space");
-        return ret;
+        if (disk->map != NULL)
+            munmap(disk->map, disk->layout_size);
+        close(fd);
+        device_free(disk);
     }
+    return ret;
+}
+/**
+ * @brief 将多个设备条带化为一个逻辑设备。容量为成员最小容量按条带单元取整后乘以成员数，
+ * 逻辑设备本身不计延迟，子请求由各成员的工作线程并行服务并各自模拟延迟，
+ * IOC_REQ_DEVICE_TIME等返回最忙成员的设备时钟
+ * 
+ * @param paths 成员路径
+ * @param nr 成员个数
+ * @param stripe_unit 条带单元，须为IO单位的整数倍
+ * @param cfg 成员配置，NULL则沿用各镜像中的配置
+ * @return int 逻辑设备的文件描述符
+ */
+int ddriver_open_stripe(char **paths, int nr, int stripe_unit, struct ddriver_config *cfg) {
+    struct ddriver *disk;
+    struct ddriver_stripe *stripe;
+    struct stripe_lane *lane;
+    struct ddriver_config conf = DDRIVER_CONFIG_DEFAULT, member_conf;   /* Taken from the first member */
+    char spec[PATH_MAX] = DDRIVER_STRIPE_PREFIX;
+    char log_path[PATH_MAX + 16] = {0};
+    long long member_sz = -1;
+    int i, fd, ret, nr_workers = 0;
 
-    debugf = fopen(log_path, "w+");
-    if (debugf == NULL) {
-        user_panic("can't init log: %s", log_path);
-        return -1;
+    if (paths == NULL || nr <= 0 || nr > DDRIVER_STRIPE_MAX || stripe_unit <= 0) {
+        user_panic("stripe over %d devices with unit %d out of range", nr, stripe_unit);
+        return -EINVAL;
+    }
+    stripe = (struct ddriver_stripe *)calloc(1, sizeof(struct ddriver_stripe));
+    disk = device_alloc();
+    if (stripe == NULL || disk == NULL) {
+        user_panic("no memory for stripe device");
+        free(stripe);
+        if (disk != NULL)
+            device_free(disk);
+        return -ENOMEM;
     }
+    stripe->unit = stripe_unit;
+    snprintf(spec + strlen(spec), sizeof(spec) - strlen(spec), "%d:", stripe_unit);
+    for (i = 0; i < nr; i++) {
+        fd = ddriver_open_ex(paths[i], cfg);
+        if (fd < 0) {
+            ret = fd;
+            goto err;
+        }
+        lane = &stripe->lanes[stripe->nr++];
+        lane->fd = fd;
+        pthread_mutex_init(&lane->lock, NULL);
+        pthread_cond_init(&lane->cond, NULL);
+        ret = ddriver_ioctl(fd, IOC_REQ_DEVICE_CONFIG, &member_conf);
+        if (ret < 0) {
+            goto err;
+        }
+        if (i == 0) {
+            conf = member_conf;
+        }
+        if (member_conf.iounit_size != conf.iounit_size || stripe_unit % conf.iounit_size != 0) {
+            user_panic("stripe unit %d should align to the io unit %d of every member", 
+                       stripe_unit, member_conf.iounit_size);
+            ret = -EINVAL;
+            goto err;
+        }
+        if (member_sz < 0 || member_conf.capacity < member_sz) {
+            member_sz = member_conf.capacity;
+        }
+        snprintf(spec + strlen(spec), sizeof(spec) - strlen(spec), i ? ",%s" : "%s", paths[i]);
+    }
+    conf.capacity = nr * (member_sz / stripe_unit) * stripe_unit;
+    if (conf.capacity == 0) {
+        user_panic("stripe unit %d exceeds member capacity %lld", stripe_unit, member_sz);
+        ret = -EINVAL;
+        goto err;
+    }
+    config_apply(disk, &conf);                        /* Latencies only reported, see emulate_delay */
+    disk->backend = DDRIVER_BACKEND_STRIPE;
+    disk->stripe  = stripe;
 
+    for (i = 0; i < stripe->nr; i++) {
+        ret = pthread_create(&stripe->lanes[i].worker, NULL, stripe_worker, &stripe->lanes[i]);
+        if (ret != 0) {
+            user_panic("can't start stripe worker: %s", strerror(ret));
+            ret = -ret;
+            goto err;
+        }
+        nr_workers++;
+    }
+    fd = dup(stripe->lanes[0].fd);                    /* A distinct fd as the handle */
+    if (fd < 0) {
+        ret = -errno;
+        goto err;
+    }
+    snprintf(log_path, sizeof(log_path), "%s_stripe" DEVICE_LOG, paths[0]);
+    ret = device_register(disk, fd, spec, log_path);
+    if (ret < 0) {
+        close(fd);
+        goto err;
+    }
     return fd;
+err:
+    stripe_close(stripe, nr_workers);
+    device_free(disk);
+    return ret;
 }
 /**
- * @brief 关闭驱动
+ * @brief 关闭驱动，并在日志中记录虚拟设备时钟与读写寻道次数
  * 
  * @param fd 
  * @return int 
  */
 int ddriver_close(int fd) {
-    return close(fd) && fclose(debugf);
+    struct ddriver *disk;
+    struct ddriver_state state;
+    int ret;
+    GET_DEVICE(fd, disk);
+
+    ddriver_queue_exit(fd);
+    pthread_mutex_lock(&devices_lock);
+    __atomic_store_n(&devices[fd], NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&devices_lock);
+    trace_close(&disk->trace);
+    user_log("device clock %lld us, wall %lld us", 
+             device_clock(disk), now_us() - disk->open_us);
+    stats_collect(disk, &state, NULL);                /* Same counters as IOC_REQ_DEVICE_STATE */
+    user_log("device state read %lld write %lld seek %lld", 
+             state.read_cnt, state.write_cnt, state.seek_cnt);
+    if (disk->map != NULL) {
+        if (disk->backend == DDRIVER_BACKEND_MMAP)
+            msync(disk->map, disk->layout_size, MS_SYNC);
+        munmap(disk->map, disk->layout_size);
+        disk->map = NULL;
+    }
+    if (disk->stripe != NULL) {
+        stripe_close(disk->stripe, disk->stripe->nr);
+        disk->stripe = NULL;
+    }
+    ret = close(fd);
+    fclose(disk->debugf);
+    device_free(disk);
+    return ret;
 }
 /**
- * @brief 磁盘头SEEK
+ * @brief 磁盘头SEEK，只移动驱动维护的读写位置，不产生系统调用
  * 
  * @param fd 
  * @param offset 
@@ -179,24 +1658,41 @@ int ddriver_close(int fd) {
  * @return int 
  */
 int ddriver_seek(int fd, off_t offset, int whence){
-    int ret = 0;
-    int cur = 0;
+    struct ddriver *disk;
+    off_t pos;
+    off_t cur = 0;
+    GET_DEVICE(fd, disk);
 
     if (!IS_ADDR_ALIGN(offset)) {
         user_alert("offset %ld must be aligned to block size %d", 
-                      offset, CONFIG_BLOCK_SZ);
+                      offset, disk->iounit_size);
         return -EINVAL;
     }
 
-    INC_SEEKCNT(disk);
-    cur = lseek(fd, 0, SEEK_CUR);
-    ret = lseek(fd, offset, whence);
-    if (ret < 0) {
-        user_panic("seek error: %s", strerror(errno));
-        return ret;
+    switch (whence)
+    {
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = disk->pos + offset;
+        break;
+    case SEEK_END:
+        pos = disk->layout_size + offset;
+        break;
+    default:
+        return -EINVAL;
     }
-    emulate_rotate(fd, cur, ret);
-    return ret;
+    if (pos < 0 || pos > disk->layout_size) {
+        user_panic("seek error: %ld out of disk", pos);
+        return -EINVAL;
+    }
+
+    disk->pos = pos;
+    cur = SWAP_HEAD(disk, pos);
+    account_seek(disk, cur, pos);
+    emulate_rotate(disk, cur, pos);
+    return pos;
 }
 /**
  * @brief 磁盘写入，写入大小可通过IOCTL查询
@@ -207,15 +1703,30 @@ int ddriver_seek(int fd, off_t offset, int whence){
  * @return int 
  */
 int ddriver_write(int fd, char *buf, size_t size){
-    int res = check_valid(size);
+    struct ddriver *disk;
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    ssize_t ret;
+    long long lat;
+    int res;
+    GET_DEVICE(fd, disk);
+
+    res = check_valid(disk, size);
+    if(res < 0)
+        return res;
+    res = check_valid_range(disk, disk->pos, size);
     if(res < 0)
         return res;
-        
-    RW_DELAY(disk, write);
-    write(fd, buf, size);
 
+    lat = RW_DELAY(disk, write);
+    ret = backend_pwritev(disk, &iov, 1, disk->pos);
+    if (ret < 0)
+        return ret;
+    account_io(disk, DDRIVER_OP_WRITE, disk->pos, size, lat);
+
+    disk->pos += size;
+    FORWARD_HEAD(disk, size);
     INC_WRITECNT(disk);
-    return CONFIG_BLOCK_SZ;
+    return disk->iounit_size;
 }
 /**
  * @brief 
@@ -226,15 +1737,178 @@ int ddriver_write(int fd, char *buf, size_t size){
  * @return int 
  */
 int ddriver_read(int fd, char *buf, size_t size){
-    int res = check_valid(size);
+    struct ddriver *disk;
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    ssize_t ret;
+    long long lat;
+    int res;
+    GET_DEVICE(fd, disk);
+
+    res = check_valid(disk, size);
+    if(res < 0)
+        return res;
+    res = check_valid_range(disk, disk->pos, size);
     if(res < 0)
         return res;
 
-    RW_DELAY(disk, read);
-    read(fd, buf, size);
+    lat = RW_DELAY(disk, read);
+    ret = backend_preadv(disk, &iov, 1, disk->pos);
+    if (ret < 0)
+        return ret;
+    account_io(disk, DDRIVER_OP_READ, disk->pos, size, lat);
+
+    disk->pos += size;
+    FORWARD_HEAD(disk, size);
+    INC_READCNT(disk);
+    return disk->iounit_size;
+}
+/**
+ * @brief 磁盘向量写，一次请求写入多个IO单位
+ * 
+ * 延迟按请求计一次RW_DELAY，再按IO单位数计传输开销
+ * 
+ * @param fd 
+ * @param iov 每段长度须为IO单位的整数倍
+ * @param iovcnt 
+ * @return int 写入的字节数
+ */
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt){
+    struct ddriver *disk;
+    size_t  size;
+    ssize_t ret;
+    long long lat;
+    int res;
+    GET_DEVICE(fd, disk);
+
+    res = check_valid_vec(disk, iov, iovcnt, &size);
+    if(res < 0)
+        return res;
+    res = check_valid_range(disk, disk->pos, size);
+    if(res < 0)
+        return res;
+
+    lat  = RW_DELAY(disk, write);
+    lat += XFER_DELAY(disk, size / disk->iounit_size);
+    ret = backend_pwritev(disk, iov, iovcnt, disk->pos);
+    if (ret < 0)
+        return ret;
+    account_io(disk, DDRIVER_OP_WRITE, disk->pos, ret, lat);
+
+    disk->pos += ret;
+    FORWARD_HEAD(disk, ret);
+    INC_WRITECNT(disk);
+    return ret;
+}
+/**
+ * @brief 磁盘向量读，一次请求读出多个IO单位
+ * 
+ * @param fd 
+ * @param iov 每段长度须为IO单位的整数倍
+ * @param iovcnt 
+ * @return int 读出的字节数
+ */
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt){
+    struct ddriver *disk;
+    size_t  size;
+    ssize_t ret;
+    long long lat;
+    int res;
+    GET_DEVICE(fd, disk);
+
+    res = check_valid_vec(disk, iov, iovcnt, &size);
+    if(res < 0)
+        return res;
+    res = check_valid_range(disk, disk->pos, size);
+    if(res < 0)
+        return res;
+
+    lat  = RW_DELAY(disk, read);
+    lat += XFER_DELAY(disk, size / disk->iounit_size);
+    ret = backend_preadv(disk, iov, iovcnt, disk->pos);
+    if (ret < 0)
+        return ret;
+    account_io(disk, DDRIVER_OP_READ, disk->pos, ret, lat);
+
+    disk->pos += ret;
+    FORWARD_HEAD(disk, ret);
+    INC_READCNT(disk);
+    return ret;
+}
+/**
+ * @brief 定位写，不依赖也不移动fd的读写位置，可多线程并发调用
+ * 
+ * 旋转延迟按上一次服务结束的位置计算
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size IO单位的整数倍
+ * @param offset 须与IO单位对齐
+ * @return int 写入的字节数
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset){
+    struct ddriver *disk;
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    ssize_t ret;
+    off_t   last;
+    long long lat = 0;
+    int res;
+    GET_DEVICE(fd, disk);
+
+    res = check_valid_pos(disk, size, offset);
+    if(res < 0)
+        return res;
+
+    last = SWAP_HEAD(disk, offset + size);
+    if (last != offset) {
+        account_seek(disk, last, offset);
+        lat += emulate_rotate(disk, last, offset);
+    }
+    lat += RW_DELAY(disk, write);
+    lat += XFER_DELAY(disk, size / disk->iounit_size);
+    ret = backend_pwritev(disk, &iov, 1, offset);
+    if (ret < 0)
+        return ret;
+    account_io(disk, DDRIVER_OP_WRITE, offset, size, lat);
+
+    INC_WRITECNT(disk);
+    return ret;
+}
+/**
+ * @brief 定位读，不依赖也不移动fd的读写位置，可多线程并发调用
+ * 
+ * @param fd 
+ * @param buf 
+ * @param size IO单位的整数倍
+ * @param offset 须与IO单位对齐
+ * @return int 读出的字节数
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset){
+    struct ddriver *disk;
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    ssize_t ret;
+    off_t   last;
+    long long lat = 0;
+    int res;
+    GET_DEVICE(fd, disk);
+
+    res = check_valid_pos(disk, size, offset);
+    if(res < 0)
+        return res;
+
+    last = SWAP_HEAD(disk, offset + size);
+    if (last != offset) {
+        account_seek(disk, last, offset);
+        lat += emulate_rotate(disk, last, offset);
+    }
+    lat += RW_DELAY(disk, read);
+    lat += XFER_DELAY(disk, size / disk->iounit_size);
+    ret = backend_preadv(disk, &iov, 1, offset);
+    if (ret < 0)
+        return ret;
+    account_io(disk, DDRIVER_OP_READ, offset, size, lat);
 
     INC_READCNT(disk);
-    return CONFIG_BLOCK_SZ;
+    return ret;
 }
 /**
  * @brief 
@@ -245,35 +1919,305 @@ int ddriver_read(int fd, char *buf, size_t size){
  * @return int 
  */
 int ddriver_ioctl(int fd, unsigned long cmd, void *arg){
+    struct ddriver *disk;
+    struct ddriver_queue *queue;
     struct ddriver_state state;
+    struct ddriver_sched_state sched_state;
+    struct ddriver_config conf;
+    struct ddriver_time time;
+    struct ddriver_range range;
+    long long clock;
+    int policy;
+    int profile;
+    int mode;
+    int tag;
+    int i;
+    int size;
+    int ret;
+    GET_DEVICE(fd, disk);
+    queue = &disk->queue;
+
     switch (cmd)
     {
     case IOC_REQ_DEVICE_SIZE:                         /* Device Size */
-        memcpy(arg, &disk.layout_size, sizeof(int));
+        size = disk->layout_size;                     /* Fits: capped by CONFIG_MAX_DISK_SZ */
+        memcpy(arg, &size, sizeof(int));
+        break;
+    case IOC_REQ_DEVICE_CONFIG:                       /* Device Geometry */
+        conf.capacity    = disk->layout_size;
+        conf.iounit_size = disk->iounit_size;
+        conf.track_num   = disk->track_num;
+        conf.read_lat    = disk->read_lat;
+        conf.write_lat   = disk->write_lat;
+        conf.seek_lat    = disk->seek_lat;
+        conf.xfer_lat    = disk->xfer_lat;
+        memcpy(arg, &conf, sizeof(struct ddriver_config));
         break;
     case IOC_REQ_DEVICE_STATE:                        /* Device State */
-        state.read_cnt = disk.read_cnt;
-        state.write_cnt = disk.write_cnt;
-        state.seek_cnt = disk.seek_cnt;
+        stats_collect(disk, &state, NULL);
         memcpy(arg, &state, sizeof(struct ddriver_state));
         break;
     case IOC_REQ_DEVICE_RESET:                        /* Reset Device */
-        lseek(fd, 0, SEEK_SET);
-        char buf[4096] = {'\0'};
-        for (size_t i = 0; i < CONFIG_DISK_SZ; i += 4096)
-        {
-            write(fd, buf, 4096);
-        }
-        lseek(fd, 0, SEEK_SET);
-        disk.read_cnt = 0;
-        disk.write_cnt = 0;
-        disk.seek_cnt = 0;
+        if (disk->stripe != NULL)
+            ret = stripe_ioctl(disk, cmd, arg);       /* Members reset their own counters too */
+        else
+            ret = backend_discard(disk, 0, disk->layout_size);
+        if (ret < 0) {
+            return ret;
+        }
+        disk->pos = 0;
+        SET_HEAD(disk, 0);
+        disk->open_us = now_us();
+        stats_reset(disk);
+        pthread_mutex_lock(&queue->lock);
+        memset(queue->stat, 0, sizeof(queue->stat));
+        for (i = 0; i < CONFIG_MAX_WORKERS; i++) {       /* Virtual clock restarts at 0 */
+            if (queue->lane_vus[i] != LLONG_MAX)
+                queue->lane_vus[i] = 0;
+        }
+        pthread_mutex_unlock(&queue->lock);
         break;
     case IOC_REQ_DEVICE_IO_SZ:
-        memcpy(arg, &disk.iounit_size, sizeof(int));
+        memcpy(arg, &disk->iounit_size, sizeof(int));
+        break;
+    case IOC_REQ_DEVICE_DISCARD:                      /* Discard Range */
+        memcpy(&range, arg, sizeof(struct ddriver_range));
+        ret = check_valid_pos(disk, range.size, range.offset);
+        if (ret < 0) {
+            return ret;
+        }
+        ret = backend_discard(disk, range.offset, range.size);
+        if (ret < 0) {
+            return ret;
+        }
+        STAT_ADD(discard_cnt, 1);
+        STAT_ADD(discard_bytes, range.size);
+        break;
+    case IOC_REQ_DEVICE_FLUSH:                        /* Flush Device */
+        pthread_mutex_lock(&disk->trace.lock);
+        trace_flush_locked(&disk->trace);
+        pthread_mutex_unlock(&disk->trace.lock);
+        if (disk->backend == DDRIVER_BACKEND_STRIPE)
+            ret = stripe_ioctl(disk, cmd, arg);
+        else if (disk->backend == DDRIVER_BACKEND_MMAP)
+            ret = msync(disk->map, disk->layout_size, MS_SYNC);
+        else if (disk->backend == DDRIVER_BACKEND_KERNEL)
+            ret = 0;                                  /* Kernel layout is the disk itself */
+        else
+            ret = fsync(fd);
+        if (ret < 0) {
+            user_panic("flush error: %s", strerror(errno));
+            return -errno;
+        }
+        break;
+    case IOC_REQ_DEVICE_SCHED:                        /* Select Scheduler */
+        memcpy(&policy, arg, sizeof(int));
+        if (policy < 0 || policy >= DDRIVER_SCHED_NR) {
+            user_alert("unknown scheduler %d", policy);
+            return -EINVAL;
+        }
+        pthread_mutex_lock(&queue->lock);
+        queue->policy = policy;
+        pthread_mutex_unlock(&queue->lock);
+        break;
+    case IOC_REQ_DEVICE_PROFILE:                      /* Latency Profile */
+        memcpy(&profile, arg, sizeof(int));
+        if (profile < 0 || profile >= DDRIVER_PROFILE_NR) {
+            user_alert("unknown latency profile %d", profile);
+            return -EINVAL;
+        }
+        disk->read_lat  = profiles[profile].read_lat;
+        disk->write_lat = profiles[profile].write_lat;
+        disk->seek_lat  = profiles[profile].seek_lat;
+        disk->xfer_lat  = profiles[profile].xfer_lat * (disk->iounit_size / 512);
+        if (disk->stripe != NULL)
+            return stripe_ioctl(disk, cmd, arg);
+        break;
+    case IOC_REQ_DEVICE_DELAY:                        /* Delay Mode */
+        memcpy(&mode, arg, sizeof(int));
+        if (mode < 0 || mode >= DDRIVER_DELAY_NR) {
+            user_alert("unknown delay mode %d", mode);
+            return -EINVAL;
+        }
+        disk->delay_mode = mode;
+        if (disk->stripe != NULL)
+            return stripe_ioctl(disk, cmd, arg);
+        break;
+    case IOC_REQ_DEVICE_TIME:                         /* Device Time */
+        time.device_us = device_clock(disk);
+        time.wall_us   = now_us() - disk->open_us;
+        memcpy(arg, &time, sizeof(struct ddriver_time));
+        break;
+    case IOC_REQ_DEVICE_STATS:                        /* Extended Stats */
+        stats_collect(disk, NULL, (struct ddriver_stats *)arg);
+        ((struct ddriver_stats *)arg)->busy_us = device_clock(disk);
+        break;
+    case IOC_REQ_TRACE_TAG:                           /* Caller Tag */
+        memcpy(&tag, arg, sizeof(int));
+        if (tag < SHRT_MIN || tag > SHRT_MAX) {       /* Recorded as a short */
+            user_alert("trace tag %d out of range", tag);
+            return -EINVAL;
+        }
+        trace_tag = tag;
+        break;
+    case IOC_REQ_DEVICE_CLOCK:                        /* Virtual Clock */
+        clock = device_clock(disk);
+        memcpy(arg, &clock, sizeof(long long));
+        break;
+    case IOC_REQ_SCHED_STATE:                         /* Scheduler State */
+        pthread_mutex_lock(&queue->lock);
+        sched_state.policy = queue->policy;
+        memcpy(sched_state.stat, queue->stat, sizeof(queue->stat));
+        pthread_mutex_unlock(&queue->lock);
+        memcpy(arg, &sched_state, sizeof(struct ddriver_sched_state));
         break;
     default:
         break;
     }
     return 0;
+}
+/**
+ * @brief 建立异步请求队列，启动工作线程
+ * 
+ * @param fd 
+ * @param depth 队列深度，即最多同时在途的请求数
+ * @return int 0成功，否则失败
+ */
+int ddriver_queue_init(int fd, int depth) {
+    struct ddriver *disk;
+    struct ddriver_queue *queue;
+    int i, ret;
+    GET_DEVICE(fd, disk);
+    queue = &disk->queue;
+
+    if (queue->depth) {
+        user_alert("queue already set up with depth %d", queue->depth);
+        return -EBUSY;
+    }
+    if (depth <= 0 || depth > CONFIG_MAX_QD) {
+        user_alert("queue depth %d out of range [1, %d]", depth, CONFIG_MAX_QD);
+        return -EINVAL;
+    }
+
+    queue->depth      = depth;
+    queue->nr_workers = depth < CONFIG_MAX_WORKERS ? depth : CONFIG_MAX_WORKERS;
+    queue->inflight   = 0;
+    queue->nr_pending = 0;
+    queue->nr_done    = 0;
+    queue->cq_head    = 0;
+    queue->stop       = 0;
+    queue->sched_head = 0;
+    memset(queue->lane_vus, 0, sizeof(queue->lane_vus));
+    for (i = 0; i < queue->nr_workers; i++) {
+        ret = pthread_create(&queue->workers[i], NULL, queue_worker, disk);
+        if (ret != 0) {
+            user_panic("can't start queue worker: %s", strerror(ret));
+            queue->nr_workers = i;
+            ddriver_queue_exit(fd);
+            return -ret;
+        }
+    }
+    return 0;
+}
+/**
+ * @brief 等待在途请求完成并销毁异步队列，未被收割的完成请求将被丢弃
+ * 
+ * @param fd 
+ * @return int 
+ */
+int ddriver_queue_exit(int fd) {
+    struct ddriver *disk;
+    struct ddriver_queue *queue;
+    int i;
+    GET_DEVICE(fd, disk);
+    queue = &disk->queue;
+
+    if (!queue->depth) {
+        return 0;
+    }
+    pthread_mutex_lock(&queue->lock);
+    queue->stop = 1;
+    pthread_cond_broadcast(&queue->sq_cond);
+    pthread_mutex_unlock(&queue->lock);
+    for (i = 0; i < queue->nr_workers; i++) {
+        pthread_join(queue->workers[i], NULL);
+    }
+    queue->depth = 0;
+    return 0;
+}
+/**
+ * @brief 提交异步请求，立即返回
+ * 
+ * @param fd 
+ * @param reqs 请求数组，完成前请求及其buf须保持有效
+ * @param nr 请求个数
+ * @return int 实际提交的请求数，队列满时可能小于nr
+ */
+int ddriver_submit(int fd, struct ddriver_req **reqs, int nr) {
+    struct ddriver *disk;
+    struct ddriver_queue *queue;
+    int i, n;
+    long long submit_us, submit_vus;
+    GET_DEVICE(fd, disk);
+    queue = &disk->queue;
+
+    if (!queue->depth) {
+        user_alert("queue not set up, call ddriver_queue_init first");
+        return -EINVAL;
+    }
+    pthread_mutex_lock(&queue->lock);
+    n = queue->depth - queue->inflight;
+    n = nr < n ? nr : n;
+    submit_us  = now_us();
+    submit_vus = __atomic_load_n(&SHARD(disk)->device_us, __ATOMIC_RELAXED);
+    for (i = 0; i < n; i++) {
+        reqs[i]->res = 0;
+        queue->pending[queue->nr_pending].req        = reqs[i];
+        queue->pending[queue->nr_pending].submit_us  = submit_us;
+        queue->pending[queue->nr_pending].submit_vus = submit_vus;
+        queue->pending[queue->nr_pending].tag        = trace_tag;
+        queue->nr_pending++;
+    }
+    queue->inflight += n;
+    if (n > 0) {
+        pthread_cond_broadcast(&queue->sq_cond);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return n;
+}
+/**
+ * @brief 收割已完成的异步请求
+ * 
+ * @param fd 
+ * @param reqs 输出已完成的请求，结果见req->res
+ * @param min_nr 至少等待完成的请求数，超过在途请求数时按在途数计
+ * @param max_nr 最多收割的请求数
+ * @return int 收割的请求数
+ */
+int ddriver_reap(int fd, struct ddriver_req **reqs, int min_nr, int max_nr) {
+    struct ddriver *disk;
+    struct ddriver_queue *queue;
+    int n = 0;
+    GET_DEVICE(fd, disk);
+    queue = &disk->queue;
+
+    if (!queue->depth) {
+        user_alert("queue not set up, call ddriver_queue_init first");
+        return -EINVAL;
+    }
+    pthread_mutex_lock(&queue->lock);
+    min_nr = min_nr < queue->inflight ? min_nr : queue->inflight;
+    min_nr = min_nr < max_nr ? min_nr : max_nr;
+    while (queue->nr_done < min_nr) {
+        pthread_cond_wait(&queue->cq_cond, &queue->lock);
+    }
+    while (n < max_nr && queue->nr_done > 0) {
+        clock_advance(&SHARD(disk)->device_us, queue->done_vus[queue->cq_head]);   /* Waited for it */
+        reqs[n++] = queue->done[queue->cq_head];
+        queue->cq_head = (queue->cq_head + 1) % CONFIG_MAX_QD;
+        queue->nr_done--;
+    }
+    queue->inflight -= n;
+    pthread_mutex_unlock(&queue->lock);
+    return n;
 }
\ No newline at end of file
@@ -0,0 +1,233 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include <unistd.h>
+#include <getopt.h>
+#include <limits.h>
+#include "include/ddriver.h"
+/******************************************************************************
+* SECTION: Macro definitions
+*******************************************************************************/
+#define DEVICE_NAME     "ddriver"
+#define REPLAY_BATCH    (4096)                       /* Records read from the trace at a time */
+#define NEWFS_MAGIC     (0x2001113)                  /* Superblocks at offset 0, see fs/ */
+#define SFS_MAGIC       (0x52415453)
+/******************************************************************************
+* SECTION: Global Variable
+*******************************************************************************/
+char *profile_names[DDRIVER_PROFILE_NR] = { "none", "hdd", "sata", "nvme" };
+char *delay_names[DDRIVER_DELAY_NR]     = { "sleep", "spin", "virtual" };
+char *op_names[DDRIVER_OP_NR]           = { "read", "write" };
+struct option long_opts[] = {
+    { "force", no_argument, NULL, 'F' },
+    { NULL,    0,           NULL, 0   }
+};
+/******************************************************************************
+* SECTION: Helper Functions
+*******************************************************************************/
+void usage(char *prog) {
+    printf("用法: %s [-p none|hdd|sata|nvme] [-d sleep|spin|virtual] [--force] -f image trace\n", prog);
+    printf("按DDRIVER_TRACE采集的追踪文件重放请求，写请求以无意义的数据覆盖设备内容\n");
+    printf("闭环重放：上一个请求完成后立即发出下一个，忽略记录中的时间戳ts_us\n");
+    printf("-p            延迟模型，默认沿用设备配置\n");
+    printf("-d            延迟方式，默认virtual\n");
+    printf("-f            重放的目标设备，必须指定，应为镜像的副本\n");
+    printf("--force       目标上有newfs/simplefs文件系统时仍然重放\n");
+}
+
+int lookup(char **names, int nr, char *name) {
+    int i;
+    for (i = 0; i < nr; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+/**
+ * @brief 目标设备开头是否为newfs或simplefs的超级块
+ * 
+ * @param fd 
+ * @param iounit_size 
+ * @return int 1是，0否，负数为读失败
+ */
+int has_fs(int fd, int iounit_size) {
+    unsigned int magic;
+    char *buf = (char *)malloc(iounit_size);
+    int ret;
+
+    if (buf == NULL) {
+        return -1;
+    }
+    ret = ddriver_pread(fd, buf, iounit_size, 0);
+    if (ret == iounit_size) {
+        memcpy(&magic, buf, sizeof(magic));
+        ret = magic == NEWFS_MAGIC || magic == SFS_MAGIC;
+    }
+    else {
+        ret = -1;
+    }
+    free(buf);
+    return ret;
+}
+
+void report(struct ddriver_stats *stats, struct ddriver_time *time) {
+    struct ddriver_op_stat *stat;
+    int op, i;
+
+    printf("device time: %lld us, wall time: %lld us\n", time->device_us, time->wall_us);
+    printf("seek: %lld, seek distance: %lld B\n", stats->seek_cnt, stats->seek_dist);
+    printf("discard: %lld, discarded: %lld B\n", stats->discard_cnt, stats->discard_bytes);
+    for (op = 0; op < DDRIVER_OP_NR; op++) {
+        stat = &stats->op[op];
+        if (stat->cnt == 0) {
+            continue;
+        }
+        printf("%-5s cnt: %lld, bytes: %lld, avg lat: %lld us\n", op_names[op],
+               stat->cnt, stat->bytes, stat->lat_us / stat->cnt);
+        for (i = 0; i < DDRIVER_HIST_NR; i++) {
+            if (stat->hist[i] != 0) {
+                printf("      [%lld, %lld) us: %lld\n", i == 0 ? 0 : 1LL << (i - 1),
+                       i == 0 ? 1 : 1LL << i, stat->hist[i]);
+            }
+        }
+    }
+}
+/******************************************************************************
+* SECTION: Main
+*******************************************************************************/
+int main(int argc, char *argv[])
+{
+    struct ddriver_trace_hdr hdr;
+    struct ddriver_trace_rec *recs;
+    struct ddriver_config    cfg;
+    struct ddriver_stats     stats;
+    struct ddriver_time      time;
+    char   device_path[PATH_MAX] = {0};
+    char   *buf, *grown;
+    FILE   *trace;
+    int    profile = -1, mode = DDRIVER_DELAY_VIRTUAL, force = 0;
+    int    fd, opt, i, nr, ret, max_size = 0;
+    long long replayed = 0, failed = 0;
+
+    while ((opt = getopt_long(argc, argv, "p:d:f:h", long_opts, NULL)) != -1) {
+        switch (opt)
+        {
+        case 'p':
+            profile = lookup(profile_names, DDRIVER_PROFILE_NR, optarg);
+            if (profile < 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'd':
+            mode = lookup(delay_names, DDRIVER_DELAY_NR, optarg);
+            if (mode < 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'f':
+            snprintf(device_path, sizeof(device_path), "%s", optarg);
+            break;
+        case 'F':
+            force = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 0;
+        }
+    }
+    if (optind >= argc || device_path[0] == '\0') {  /* No default: ~/ddriver is a live fs */
+        usage(argv[0]);
+        return -1;
+    }
+
+    trace = fopen(argv[optind], "r");
+    if (trace == NULL || fread(&hdr, sizeof(hdr), 1, trace) != 1 ||
+        hdr.magic != DDRIVER_TRACE_MAGIC || hdr.version != DDRIVER_TRACE_VERSION) {
+        printf("invalid trace: %s\n", argv[optind]);
+        return -1;
+    }
+
+    unsetenv(DDRIVER_TRACE_ENV);                     /* Never trace the replay itself */
+    fd = ddriver_open(device_path);
+    if (fd < 0) {
+        return -1;
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_CONFIG, &cfg);
+    if (cfg.capacity < hdr.capacity || cfg.iounit_size != hdr.iounit_size) {
+        printf("device [%lld B, io %d] can't hold trace [%lld B, io %d]\n",
+               cfg.capacity, cfg.iounit_size, hdr.capacity, hdr.iounit_size);
+        ddriver_close(fd);
+        return -1;
+    }
+    ret = has_fs(fd, cfg.iounit_size);
+    if (ret != 0 && !force) {
+        printf(ret > 0 ? "%s holds a file system, replay onto a copy or pass --force\n"
+                       : "can't read %s\n", device_path);
+        ddriver_close(fd);
+        fclose(trace);
+        return -1;
+    }
+    ddriver_close(fd);                                /* Reopen so the probe is not in the stats */
+    fd = ddriver_open(device_path);
+    if (fd < 0) {
+        fclose(trace);
+        return -1;
+    }
+    if (profile >= 0) {
+        ddriver_ioctl(fd, IOC_REQ_DEVICE_PROFILE, &profile);
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_DELAY, &mode);
+
+    recs = (struct ddriver_trace_rec *)malloc(REPLAY_BATCH * sizeof(struct ddriver_trace_rec));
+    buf  = NULL;
+    if (recs == NULL) {
+        printf("out of memory\n");
+        fclose(trace);
+        ddriver_close(fd);
+        return -1;
+    }
+    while ((nr = fread(recs, sizeof(struct ddriver_trace_rec), REPLAY_BATCH, trace)) > 0) {
+        for (i = 0; i < nr; i++) {
+            if (recs[i].size > max_size) {
+                grown = (char *)realloc(buf, recs[i].size);
+                if (grown == NULL) {                 /* Counted as failed, buf still valid */
+                    failed++;
+                    continue;
+                }
+                buf = grown;
+                max_size = recs[i].size;
+                memset(buf, 0, max_size);
+            }
+            if (recs[i].op == DDRIVER_OP_WRITE)
+                ret = ddriver_pwrite(fd, buf, recs[i].size, recs[i].offset);
+            else
+                ret = ddriver_pread(fd, buf, recs[i].size, recs[i].offset);
+            if (ret != recs[i].size) {
+                failed++;
+            }
+        }
+        replayed += nr;
+    }
+    if (ferror(trace)) {
+        printf("error reading trace: %s\n", argv[optind]);
+        failed++;
+    }
+
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS, &stats);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_TIME, &time);
+    printf("replayed %lld requests, profile %s, delay %s\n", replayed,
+           profile >= 0 ? profile_names[profile] : "device", delay_names[mode]);
+    report(&stats, &time);
+    if (failed > 0) {
+        printf("failed: %lld\n", failed);
+    }
+
+    free(recs);
+    free(buf);
+    fclose(trace);
+    ddriver_close(fd);
+    return failed > 0 ? -1 : 0;
+}
@@ -2,20 +2,168 @@
 #define _DDRIVER_CTL_H_
 
 #include <sys/ioctl.h>   
+#include <sys/types.h>
 /******************************************************************************
 * SECTION: IO ctl protocol definitions
 *******************************************************************************/
 #define IOC_MAGIC               'A'
 struct ddriver_state
 {
-    int write_cnt;
-    int read_cnt;
-    int seek_cnt;
+    long long write_cnt;
+    long long read_cnt;
+    long long seek_cnt;
 };
 
 #define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)                     /* 请求查看设备大小 */
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)    /* 请求设备状态，返回 ddriver_state */
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)                           /* 请求重置设备 */
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)                     /* 请求设备IO大小 */
+#define IOC_REQ_DEVICE_SCHED    _IOW(IOC_MAGIC, 4, int)                     /* 选择异步队列调度策略，DDRIVER_SCHED_ */
+#define IOC_REQ_SCHED_STATE     _IOR(IOC_MAGIC, 5, struct ddriver_sched_state)  /* 请求调度器统计，返回 ddriver_sched_state */
+#define IOC_REQ_DEVICE_FLUSH    _IO(IOC_MAGIC, 6)                           /* 请求将磁盘内容刷回后端文件 */
+#define IOC_REQ_DEVICE_CONFIG   _IOR(IOC_MAGIC, 7, struct ddriver_config)   /* 请求设备几何参数，返回 ddriver_config */
+#define IOC_REQ_DEVICE_PROFILE  _IOW(IOC_MAGIC, 8, int)                     /* 选择延迟模型，DDRIVER_PROFILE_ */
+#define IOC_REQ_DEVICE_DELAY    _IOW(IOC_MAGIC, 9, int)                     /* 选择延迟方式，DDRIVER_DELAY_ */
+#define IOC_REQ_DEVICE_TIME     _IOR(IOC_MAGIC, 10, struct ddriver_time)    /* 请求设备时间，返回 ddriver_time */
+#define IOC_REQ_DEVICE_CLOCK    _IOR(IOC_MAGIC, 11, long long)              /* 请求虚拟设备时钟(us) */
+#define IOC_REQ_DEVICE_STATS    _IOR(IOC_MAGIC, 12, struct ddriver_stats)   /* 请求扩展统计，返回 ddriver_stats */
+#define IOC_REQ_TRACE_TAG       _IOW(IOC_MAGIC, 13, int)                    /* 设置本线程之后请求的追踪标签，须在short范围内 */
+#define IOC_REQ_DEVICE_DISCARD  _IOW(IOC_MAGIC, 16, struct ddriver_range)   /* 丢弃一段区间，之后读出为0 */
 
+struct ddriver_range
+{
+    long long offset;                                                       /* 须与IO单位对齐 */
+    long long size;                                                         /* IO单位的整数倍 */
+};
+
+#define DDRIVER_BACKEND_ENV     "DDRIVER_BACKEND"                           /* 设为mmap时使用内存映射后端 */
+#define DDRIVER_BACKEND_FILE    0                                           /* 文件后端，pread/pwrite */
+#define DDRIVER_BACKEND_MMAP    1                                           /* 内存映射后端，memcpy */
+#define DDRIVER_BACKEND_KERNEL  2                                           /* 内核ddriver，打开字符设备时自动选择，mmap访问 */
+#define DDRIVER_BACKEND_STRIPE  3                                           /* 条带化(RAID-0)逻辑设备，请求拆分到各成员 */
+
+#define DDRIVER_STRIPE_PREFIX   "stripe:"                                   /* 路径形如 stripe:<条带单元>:<镜像1>,<镜像2>,... */
+#define DDRIVER_STRIPE_MAX      16                                          /* 最多成员设备数 */
+
+/******************************************************************************
+* SECTION: Geometry definitions
+*******************************************************************************/
+struct ddriver_config
+{
+    long long capacity;                                                     /* 磁盘容量(B)，IO单位的整数倍，至多INT_MAX */
+    int       iounit_size;                                                  /* IO单位，512或4096 */
+    int       track_num;                                                    /* 磁道数 */
+    int       read_lat;                                                     /* 读延迟(us) */
+    int       write_lat;                                                    /* 写延迟(us) */
+    int       seek_lat;                                                     /* 旋转一周的延迟(us) */
+    int       xfer_lat;                                                     /* 每个IO单位的传输延迟(us) */
+};
+
+#define DDRIVER_CONFIG_DEFAULT  { 4 * 1024 * 1024, 512, 100, 2000, 1000, 4000, 5 }   /* 默认配置: 4MiB, 512B */
+
+#define DDRIVER_PROFILE_NONE    0                                           /* 零延迟，用于测吞吐 */
+#define DDRIVER_PROFILE_HDD     1                                           /* 机械硬盘，默认 */
+#define DDRIVER_PROFILE_SATA    2                                           /* SATA固态硬盘 */
+#define DDRIVER_PROFILE_NVME    3                                           /* NVMe固态硬盘 */
+#define DDRIVER_PROFILE_NR      4
+
+#define DDRIVER_DELAY_SLEEP     0                                           /* 睡眠等待，默认 */
+#define DDRIVER_DELAY_SPIN      1                                           /* 忙等，适合微秒级延迟 */
+#define DDRIVER_DELAY_VIRTUAL   2                                           /* 不等待，只累计设备时间 */
+#define DDRIVER_DELAY_NR        3
+#define DDRIVER_CLOCK_ENV       "DDRIVER_CLOCK"                             /* 打开时选择延迟方式: sleep/spin/virtual */
+
+struct ddriver_time
+{
+    long long device_us;                                                    /* 模拟的设备时间(us) */
+    long long wall_us;                                                      /* 打开或重置以来的真实时间(us) */
+};
+
+/******************************************************************************
+* SECTION: Async IO protocol definitions
+*******************************************************************************/
+#define DDRIVER_OP_READ         0                                           /* 异步读请求 */
+#define DDRIVER_OP_WRITE        1                                           /* 异步写请求 */
+
+struct ddriver_req
+{
+    int     op;                                                             /* DDRIVER_OP_READ / DDRIVER_OP_WRITE */
+    char*   buf;                                                            /* 数据Buf，完成前须保持有效 */
+    size_t  size;                                                           /* 须为设备IO单位的整数倍 */
+    off_t   offset;                                                         /* 须与设备IO单位对齐 */
+    void*   priv;                                                           /* 用户私有数据，驱动不做修改 */
+    int     res;                                                            /* 完成后为字节数，负数为失败 */
+};
+
+#define DDRIVER_SCHED_NOOP      0                                           /* 按到达顺序服务 */
+#define DDRIVER_SCHED_DEADLINE  1                                           /* C-SCAN顺序，请求超时优先 */
+#define DDRIVER_SCHED_CSCAN     2                                           /* 按LBA单向扫描 */
+#define DDRIVER_SCHED_NR        3
+
+struct ddriver_sched_stat
+{
+    long long dispatch_cnt;                                                 /* 派发的请求数 */
+    long long seek_cnt;                                                     /* 需要移动磁头的次数 */
+    long long seek_dist;                                                    /* 磁头移动总距离，字节 */
+    long long lat_us;                                                       /* 提交到完成的总延迟，us */
+    long long max_lat_us;                                                   /* 最大延迟，us */
+};
+
+struct ddriver_sched_state
+{
+    int policy;                                                             /* 当前调度策略 */
+    struct ddriver_sched_stat stat[DDRIVER_SCHED_NR];                       /* 各策略的统计 */
+};
+
+/******************************************************************************
+* SECTION: Extended stats definitions
+*******************************************************************************/
+#define DDRIVER_OP_NR           2                                           /* 按DDRIVER_OP_分类统计 */
+#define DDRIVER_HIST_NR         32                                          /* 延迟直方图桶数 */
+#define DDRIVER_HEAT_NR         64                                          /* LBA热度区域数 */
+
+struct ddriver_op_stat
+{
+    long long cnt;                                                          /* 请求数 */
+    long long bytes;                                                        /* 传输字节数 */
+    long long lat_us;                                                       /* 模拟延迟之和(us) */
+    long long hist[DDRIVER_HIST_NR];                                        /* hist[0]为0us，hist[i]为[2^(i-1), 2^i)us */
+};
+
+struct ddriver_stats
+{
+    struct ddriver_op_stat op[DDRIVER_OP_NR];                               /* 读写分别统计 */
+    long long seek_cnt;                                                     /* 寻道次数 */
+    long long seek_dist;                                                    /* 寻道总距离(B) */
+    long long busy_us;                                                      /* 模拟的设备忙碌时间(us) */
+    long long region_sz;                                                    /* 每个热度区域的大小(B) */
+    long long heat[DDRIVER_OP_NR][DDRIVER_HEAT_NR];                         /* 各区域读写的字节数 */
+    long long discard_cnt;                                                  /* 丢弃请求次数 */
+    long long discard_bytes;                                                /* 丢弃的总字节数 */
+};
+
+/******************************************************************************
+* SECTION: Trace definitions
+*******************************************************************************/
+#define DDRIVER_TRACE_ENV       "DDRIVER_TRACE"                             /* 追踪文件路径，打开时设置则开启追踪 */
+#define DDRIVER_TRACE_MAGIC     0x44445452                                  /* "DDTR" */
+#define DDRIVER_TRACE_VERSION   1
+
+struct ddriver_trace_hdr                                                    /* 追踪文件头，其后为ddriver_trace_rec数组 */
+{
+    int       magic;
+    int       version;
+    int       iounit_size;                                                  /* 采集时的IO单位 */
+    int       reserved;
+    long long capacity;                                                     /* 采集时的磁盘容量 */
+};
+
+struct ddriver_trace_rec
+{
+    long long ts_us;                                                        /* 完成时间，相对追踪开始(us) */
+    long long offset;
+    int       size;
+    short     op;                                                           /* DDRIVER_OP_READ / DDRIVER_OP_WRITE */
+    short     tag;                                                          /* 调用者标签，见IOC_REQ_TRACE_TAG */
+};
 #endif
\ No newline at end of file
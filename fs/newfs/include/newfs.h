@@ -9,6 +9,7 @@
 #include "string.h"
 #include "fuse.h"
 #include <stddef.h>
+#include <pthread.h>
 #include "ddriver.h"
 #include "errno.h"
 #include "types.h"
@@ -25,20 +26,69 @@ char* 				 newfs_get_fname(const char* path);
 int 			     newfs_calc_lvl(const char * path);
 int 			     newfs_driver_read(int offset, uint8_t *out_content, int size);
 int 			     newfs_driver_write(int offset, uint8_t *in_content, int size);
+int 			     newfs_driver_submit_wait(struct ddriver_req** reqs, int cnt);
 
 
 int 				 newfs_mount(struct custom_options options);
 int 				 newfs_umount();
+int 				 newfs_upgrade(struct newfs_super_d* super_d);
+int 				 newfs_discard_sync();
 
 int 			     newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry);
 int 				 newfs_drop_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry);
 struct newfs_inode*  newfs_alloc_inode(struct newfs_dentry * dentry);
 int 				 newfs_sync_inode(struct newfs_inode * inode);
+int 				 newfs_alloc_data(int goal, int want, int* got);
+void 				 newfs_bmap_init(struct newfs_inode* inode);
+int 				 newfs_bmap(struct newfs_inode* inode, int lblk);
+int 				 newfs_bmap_grow(struct newfs_inode* inode, int nblks);
+int 				 newfs_bmap_shrink(struct newfs_inode* inode, int nblks);
+int 				 newfs_bmap_collect(struct newfs_inode* inode, int from, int to, struct newfs_extent** exts);
+int 				 newfs_bmap_blks(struct newfs_inode* inode);
+void 				 newfs_drop_data(int dno);
 struct newfs_inode*  newfs_read_inode(struct newfs_dentry * dentry, int ino);
 struct newfs_dentry* newfs_get_dentry(struct newfs_inode * inode, int dir);
 
 struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean* is_root);
 /******************************************************************************
+* SECTION: newfs_cache.c
+*******************************************************************************/
+int 				 newfs_buf_init();
+void 				 newfs_buf_destroy();
+struct newfs_buf*    newfs_buf_get(int blk, boolean fill);
+int 				 newfs_buf_get_batch(int* blks, struct newfs_buf** bufs, int cnt);
+void 				 newfs_buf_put(struct newfs_buf* buf);
+void 				 newfs_buf_dirty(struct newfs_buf* buf);
+void 				 newfs_buf_forget(int blk);
+int 				 newfs_buf_sync();
+/******************************************************************************
+* SECTION: newfs_extent.c
+*******************************************************************************/
+void 				 newfs_ext_init(struct newfs_inode* inode);
+int 				 newfs_ext_map(struct newfs_inode* inode, int lblk, int* run);
+int 				 newfs_ext_append(struct newfs_inode* inode, int lblk, int start, int len);
+int 				 newfs_ext_collect(struct newfs_inode* inode, int from, int to, struct newfs_extent** exts);
+int 				 newfs_ext_blks(struct newfs_inode* inode);
+int 				 newfs_ext_grow(struct newfs_inode* inode, int nblks);
+int 				 newfs_ext_shrink(struct newfs_inode* inode, int nblks);
+/******************************************************************************
+* SECTION: newfs_indirect.c
+*******************************************************************************/
+void 				 newfs_ind_init(struct newfs_inode* inode);
+int 				 newfs_ind_map(struct newfs_inode* inode, int lblk);
+int 				 newfs_ind_blks(struct newfs_inode* inode);
+int 				 newfs_ind_collect(struct newfs_inode* inode, int from, int to, struct newfs_extent** exts);
+int 				 newfs_ind_grow(struct newfs_inode* inode, int nblks);
+int 				 newfs_ind_shrink(struct newfs_inode* inode, int nblks);
+/******************************************************************************
+* SECTION: newfs_page.c
+*******************************************************************************/
+int 				 newfs_page_read(struct newfs_inode* inode, int lblk, int cnt);
+uint8_t* 			 newfs_page_get(struct newfs_inode* inode, int lblk, boolean fill);
+void 				 newfs_page_dirty(struct newfs_inode* inode, int lblk);
+int 				 newfs_page_sync(struct newfs_inode* inode);
+void 				 newfs_page_trunc(struct newfs_inode* inode, int nblks);
+/******************************************************************************
 * SECTION: newfs.c
 *******************************************************************************/
 void* 			   newfs_init(struct fuse_conn_info *);
@@ -19,12 +19,15 @@ typedef enum newfs_file_type {
 #define UINT8_BITS              8
 
 #define NEWFS_MAGIC_NUM           0x2001113
+#define NEWFS_VERSION             3                             /* 2: inode表紧凑存放 3: 区段映射 */
 #define NEWFS_SUPER_OFS           0
 #define NEWFS_ROOT_INO            0
 
 /* 规定位图各个部分的大小，自行指定而不估计 */
 #define NEWFS_SUPER_BLKS          1
-#define NEWFS_INODE_BLKS          512
+#define NEWFS_MAX_INO             512
+#define NEWFS_INODE_BLKS_V1       512                           /* 版本1每个inode独占一块 */
+#define NEWFS_INODE_SZ_V2         32                            /* 版本2的inode槽位 */
 #define NEWFS_DATA_BLKS           2048
 #define NEWFS_MAP_INODE_BLKS      1
 #define NEWFS_MAP_DATA_BLKS       1
@@ -43,7 +46,12 @@ typedef enum newfs_file_type {
 
 #define NEWFS_MAX_FILE_NAME       128
 #define NEWFS_INODE_PER_FILE      1
-#define NEWFS_DATA_PER_FILE       4
+#define NEWFS_INODE_SZ            128                           /* 磁盘inode槽位，缓存行对齐 */
+#define NEWFS_DATA_PER_FILE       4                             /* 版本2及以前每个文件的直接块数 */
+#define NEWFS_N_BLOCKS            15                            /* inode中映射区的字数，同ext2的i_block */
+#define NEWFS_NDIR_BLOCKS         12                            /* 间接映射时的直接块数 */
+#define NEWFS_IND_LEVELS          3                             /* 一、二、三级间接块 */
+#define NEWFS_QUEUE_DEPTH         16                            /* 驱动异步队列深度 */
 #define NEWFS_DEFAULT_PERM        0777
 
 #define NEWFS_IOC_MAGIC           'S'
@@ -51,6 +59,12 @@ typedef enum newfs_file_type {
 
 #define NEWFS_FLAG_BUF_DIRTY      0x1
 #define NEWFS_FLAG_BUF_OCCUPY     0x2   
+#define NEWFS_BUF_NR              256                           /* 缓冲块个数 */
+#define NEWFS_BUF_HASH            64                            /* 缓冲哈希桶个数 */
+
+#define NEWFS_INODE_EXTENTS       0x1                           /* 映射区是区段树的根，否则是ext2式块指针 */
+#define NEWFS_EXT_MAGIC           0xF30A
+#define NEWFS_EXT_ROOT_MAX        4                             /* inode内根节点的表项数 */
 
 /******************************************************************************
 * SECTION: Macro Function
@@ -63,10 +77,26 @@ typedef enum newfs_file_type {
 #define NEWFS_ROUND_DOWN(value, round)    (value % round == 0 ? value : (value / round) * round)
 #define NEWFS_ROUND_UP(value, round)      (value % round == 0 ? value : (value / round + 1) * round)
 
-#define NEWFS_BLKS_SZ(blks)               (blks * NEWFS_BLK_SZ())
+#define NEWFS_BLKS_SZ(blks)               ((blks) * NEWFS_BLK_SZ())
 #define NEWFS_ASSIGN_FNAME(pnewfs_dentry, _fname)   memcpy(pnewfs_dentry->fname, _fname, strlen(_fname))
-#define NEWFS_INO_OFS(ino)                (newfs_super.inode_offset + ino * NEWFS_BLK_SZ())    /*求ino对应inode偏移位置*/
-#define NEWFS_DATA_OFS(dno)               (newfs_super.data_offset + dno * NEWFS_BLK_SZ())     /*求dno对应data偏移位置*/
+#define NEWFS_INODE_PER_BLK()             (NEWFS_BLK_SZ() / NEWFS_INODE_SZ)                  /*每块存放的inode个数*/
+#define NEWFS_DENTRY_PER_BLK()            ((int)(NEWFS_BLK_SZ() / sizeof(struct newfs_dentry_d)))  /*每块存放的目录项个数*/
+#define NEWFS_INO_OFS(ino)                (newfs_super.inode_offset + (ino) * NEWFS_INODE_SZ)   /*求ino对应inode偏移位置*/
+#define NEWFS_INO_OFS_V1(ino)             (newfs_super.inode_offset + (ino) * NEWFS_BLK_SZ())   /*版本1中ino的偏移位置*/
+#define NEWFS_DATA_OFS(dno)               (newfs_super.data_offset + (dno) * NEWFS_BLK_SZ())   /*求dno对应data偏移位置*/
+#define NEWFS_OFS_BLK(ofs)                ((ofs) / NEWFS_BLK_SZ())                             /*偏移所在的设备块号*/
+#define NEWFS_DATA_BLK(dno)               (NEWFS_OFS_BLK(newfs_super.data_offset) + (dno))     /*数据块的设备块号*/
+#define NEWFS_BLK_DNO(blk)                ((blk) - NEWFS_OFS_BLK(newfs_super.data_offset))     /*设备块号对应的数据块*/
+#define NEWFS_ADDR_PER_BLK()              ((int)(NEWFS_BLK_SZ() / sizeof(uint32_t)))          /*每个间接块的指针数*/
+
+#define NEWFS_MAP_TEST(map, i)            (map[(i) / UINT8_BITS] & (0x1 << ((i) % UINT8_BITS)))
+#define NEWFS_MAP_SET(map, i)             (map[(i) / UINT8_BITS] |= (0x1 << ((i) % UINT8_BITS)))
+#define NEWFS_MAP_CLEAR(map, i)           (map[(i) / UINT8_BITS] &= (uint8_t)(~(0x1 << ((i) % UINT8_BITS))))
+
+#define NEWFS_EXT_HDR(block)              ((struct newfs_extent_hdr *)(block))
+#define NEWFS_EXT_NODE_MAX()              ((NEWFS_BLK_SZ() - sizeof(struct newfs_extent_hdr)) / sizeof(struct newfs_extent))
+#define NEWFS_EXT_ENTRY(hdr, i)           ((struct newfs_extent *)((hdr) + 1) + (i))
+#define NEWFS_EXT_INDEX(hdr, i)           ((struct newfs_extent_idx *)((hdr) + 1) + (i))
 
 #define NEWFS_IS_DIR(pinode)              (pinode->dentry->ftype == NEWFS_DIR)
 #define NEWFS_IS_REG(pinode)              (pinode->dentry->ftype == NEWFS_REG_FILE)
@@ -77,8 +107,28 @@ struct newfs_dentry;
 struct newfs_inode;
 struct newfs_super;
 
+struct newfs_buf {
+    int                     blk;                            /* 缓冲的设备块号 */
+    flag16                  flags;                          /* NEWFS_FLAG_BUF_* */
+    int                     ref;                            /* CLOCK访问位 */
+    int                     pin;                            /* 使用中的引用数，非0时不换出 */
+    uint8_t*                data;                           /* NEWFS_BLK_SZ字节 */
+    struct newfs_buf*       hash_next;                      /* 同一哈希桶中的下一个 */
+};
+
+struct newfs_page {
+    uint8_t*                data;                           /* NEWFS_BLK_SZ字节，未载入为NULL */
+    boolean                 is_dirty;                       /* 修改过，刷回inode时写入 */
+};
+
+struct newfs_batch {                                        /* 一次newfs_driver_submit_wait提交的请求 */
+    int                     done;                           /* 已完成的请求数 */
+    int                     err;                            /* 有请求失败时为-NEWFS_ERROR_IO */
+};
+
 struct custom_options {
 	const char*        device;
+	const char*        mapping;                         /* 新建inode的映射方式，extent或indirect */
 	boolean            show_help;
 };
 
@@ -90,8 +140,13 @@ struct newfs_inode {
     NEWFS_FILE_TYPE         ftype;                         /* 文件类型 */
     struct newfs_dentry* dentry;                      /* 指向该inode的dentry */
     struct newfs_dentry* dentrys;                     /* 所有目录项 */
-    uint8_t*                data[NEWFS_DATA_PER_FILE];     /* 如果是FILE文件，数据块指针 */
-    int                     dno[NEWFS_DATA_PER_FILE];      /* inode指向文件的各个数据块在数据位图中的下标 */    
+    uint32_t                flags;                         /* NEWFS_INODE_* */
+    uint32_t                block[NEWFS_N_BLOCKS];         /* 映射区，区段树的根或块指针 */
+    int                     blks;                          /* 已映射的逻辑块数 */
+    struct newfs_page*      pages;                         /* 如果是FILE文件，页缓存，按逻辑块号索引 */
+    int                     nr_pages;                      /* 页表容量 */
+    boolean                 is_dirty;                      /* 是否有脏页 */
+    pthread_mutex_t         page_lock;                     /* 保护页表及各页的状态，页表扩容会移动pages */
 };
 
 struct newfs_dentry {
@@ -123,6 +178,13 @@ struct newfs_super {
     uint8_t*           map_data;               /*data位图*/
     int                map_data_blks;          /*数据位图所占的数据块*/
     int                map_data_offset;        /*数据位图的偏移,即起始地址*/
+    uint8_t*           map_discard;            /*已释放待丢弃的数据块,umount时批量下发*/
+    boolean            use_extents;            /*新建inode用区段树还是间接块*/
+
+    struct newfs_buf*  bufs;                    /*块缓冲，NEWFS_BUF_NR个*/
+    struct newfs_buf*  buf_hash[NEWFS_BUF_HASH];/*按块号散列*/
+    int                buf_hand;                /*CLOCK指针*/
+    pthread_mutex_t    buf_lock;                /*保护块缓冲的哈希表、CLOCK指针和各缓冲的状态*/
 
     int                inode_offset;            /*inode块区的偏移,即起始地址*/
     int                data_offset;             /*数据块的偏移,即起始地址*/
@@ -161,6 +223,8 @@ struct newfs_super_d {
 
     int                inode_offset;            /*inode块的偏移*/
     int                data_offset;             /*数据块的偏移*/
+    uint32_t           version;                 /*格式版本，版本1的镜像此处为0*/
+    int                max_data;                /*数据块的数目，版本3起记录*/
 };
 
 struct newfs_inode_d {
@@ -169,8 +233,40 @@ struct newfs_inode_d {
     int                     size;                          /* 文件已占用空间 */
     int                     dir_cnt;                       /* 如果是目录类型文件，下面有几个目录项 */
     NEWFS_FILE_TYPE         ftype;                         /* 文件类型 */
-    int                     dno[NEWFS_DATA_PER_FILE];      /* inode指向文件的各个数据块在数据位图中的下标 */    
+    uint32_t                flags;                         /* NEWFS_INODE_* */
+    uint32_t                block[NEWFS_N_BLOCKS];         /* 映射区 */
+};
+typedef char newfs_inode_d_fits[sizeof(struct newfs_inode_d) <= NEWFS_INODE_SZ ? 1 : -1];
+
+struct newfs_inode_d_v2 {                                  /* 版本1、2的磁盘inode */
+    uint32_t                ino;
+    int                     size;
+    int                     dir_cnt;
+    NEWFS_FILE_TYPE         ftype;
+    int                     dno[NEWFS_DATA_PER_FILE];
+};
+
+struct newfs_extent_hdr {                                  /* 区段树节点头，位于映射区或节点块开头 */
+    uint16_t                magic;                         /* NEWFS_EXT_MAGIC */
+    uint16_t                entries;                       /* 有效表项数 */
+    uint16_t                max;                           /* 表项容量 */
+    uint16_t                depth;                         /* 0为叶子，表项是区段；否则是索引 */
+    uint32_t                reserved;
+};
+
+struct newfs_extent {                                      /* 叶子表项：逻辑块lblk起连续len块 */
+    uint32_t                lblk;
+    uint32_t                len;
+    uint32_t                start;                         /* 起始数据块号 */
+};
+
+struct newfs_extent_idx {                                  /* 索引表项：lblk起的区段在子节点中 */
+    uint32_t                lblk;
+    uint32_t                leaf;                          /* 子节点的数据块号 */
+    uint32_t                reserved;
 };
+typedef char newfs_ext_root_fits[sizeof(struct newfs_extent_hdr) + NEWFS_EXT_ROOT_MAX * sizeof(struct newfs_extent)
+                                 <= NEWFS_N_BLOCKS * sizeof(uint32_t) ? 1 : -1];
 
 struct newfs_dentry_d {
     /* TODO: Define yourself */
@@ -10,6 +10,7 @@
 *******************************************************************************/
 static const struct fuse_opt option_spec[] = {		/* 用于FUSE文件系统解析参数 */
 	OPTION("--device=%s", device),
+	OPTION("--mapping=%s", mapping),
 	FUSE_OPT_END
 };
 
@@ -25,10 +26,10 @@ static struct fuse_operations operations = {
 	.getattr = newfs_getattr,				 	/* 获取文件属性，类似stat，必须完成 */
 	.readdir = newfs_readdir,				 	/* 填充dentrys */
 	.mknod = newfs_mknod,					 	/* 创建文件，touch相关 */
-	.write = NULL,								/* 写入文件 */
-	.read = NULL,								/* 读文件 */
+	.write = newfs_write,						/* 写入文件 */
+	.read = newfs_read,							/* 读文件 */
 	.utimens = newfs_utimens,				 	/* 修改时间，忽略，避免touch报错 */
-	.truncate = NULL,						  	/* 改变文件大小 */
+	.truncate = newfs_truncate,				  	/* 改变文件大小 */
 	.unlink = NULL,							  	/* 删除文件 */
 	.rmdir	= NULL,							  	/* 删除目录， rm -r */
 	.rename = NULL,							  	/* 重命名，mv */
@@ -235,6 +236,55 @@ int newfs_utimens(const char* path, const struct timespec tv[2]) {
 /******************************************************************************
 * SECTION: 选做函数实现
 *******************************************************************************/
+/**
+ * @brief 保证文件能容纳size字节，不够时按需映射数据块
+ * 
+ * @param inode 
+ * @param size 
+ * @return int 0成功，否则失败
+ */
+static int newfs_reserve(struct newfs_inode* inode, int size) {
+	if (size <= NEWFS_BLKS_SZ(inode->blks)) {
+		return NEWFS_ERROR_NONE;
+	}
+	return newfs_bmap_grow(inode, (size + NEWFS_BLK_SZ() - 1) / NEWFS_BLK_SZ());	/* 分配器尽量接在文件末尾之后 */
+}
+
+/**
+ * @brief 将内容写入文件的页缓存并标脏
+ * 
+ * 原已映射的块只写一部分时才读入旧内容，新映射的块直接清零
+ * @param inode 
+ * @param buf 写入的内容，NULL表示写零
+ * @param size 
+ * @param offset 
+ * @param old_blks 本次映射前已映射的块数
+ * @return int 0成功，否则失败
+ */
+static int newfs_fill_pages(struct newfs_inode* inode, const char* buf, int size, int offset,
+							int old_blks) {
+	uint8_t* page;
+	int		 lblk, bias, len, done;
+
+	for (done = 0; done < size; done += len) {
+		lblk = (offset + done) / NEWFS_BLK_SZ();
+		bias = (offset + done) % NEWFS_BLK_SZ();
+		len  = NEWFS_BLK_SZ() - bias < size - done ? NEWFS_BLK_SZ() - bias : size - done;
+		page = newfs_page_get(inode, lblk, lblk < old_blks && len < NEWFS_BLK_SZ());
+		if (page == NULL) {
+			return -NEWFS_ERROR_IO;
+		}
+		if (buf != NULL) {
+			memcpy(page + bias, buf + done, len);
+		}
+		else {
+			memset(page + bias, 0, len);
+		}
+		newfs_page_dirty(inode, lblk);
+	}
+	return NEWFS_ERROR_NONE;
+}
+
 /**
  * @brief 写入文件
  * 
@@ -247,7 +297,37 @@ int newfs_utimens(const char* path, const struct timespec tv[2]) {
  */
 int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		        struct fuse_file_info* fi) {
-	/* 选做 */
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_inode*  inode;
+	int		old_blks, ret;
+	
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+
+	inode = dentry->inode;
+	
+	if (NEWFS_IS_DIR(inode)) {
+		return -NEWFS_ERROR_ISDIR;	
+	}
+
+	if (inode->size < offset) {
+		return -NEWFS_ERROR_SEEK;
+	}
+
+	old_blks = inode->blks;
+	ret = newfs_reserve(inode, offset + size);
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+
+	ret = newfs_fill_pages(inode, buf, size, offset, old_blks);
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+	inode->size = offset + size > inode->size ? offset + size : inode->size;
+	
 	return size;
 }
 
@@ -263,7 +343,44 @@ int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
  */
 int newfs_read(const char* path, char* buf, size_t size, off_t offset,
 		       struct fuse_file_info* fi) {
-	/* 选做 */
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_inode*  inode;
+	uint8_t* page;
+	int		 lblk, bias, len, done;
+
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+
+	inode = dentry->inode;
+	
+	if (NEWFS_IS_DIR(inode)) {
+		return -NEWFS_ERROR_ISDIR;	
+	}
+
+	if (inode->size < offset) {
+		return -NEWFS_ERROR_SEEK;
+	}
+
+	if (offset + size > inode->size) {				/* 读到文件末尾为止 */
+		size = inode->size - offset;
+	}
+	if (size > 0 && newfs_page_read(inode, offset / NEWFS_BLK_SZ(),	/* 未载入的页一次性读入 */
+				(offset + size - 1) / NEWFS_BLK_SZ() - offset / NEWFS_BLK_SZ() + 1) != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_IO;
+	}
+	for (done = 0; done < size; done += len) {
+		lblk = (offset + done) / NEWFS_BLK_SZ();
+		bias = (offset + done) % NEWFS_BLK_SZ();
+		len  = NEWFS_BLK_SZ() - bias < size - done ? NEWFS_BLK_SZ() - bias : size - done;
+		page = newfs_page_get(inode, lblk, TRUE);
+		if (page == NULL) {
+			return -NEWFS_ERROR_IO;
+		}
+		memcpy(buf + done, page + bias, len);
+	}
+
 	return size;			   
 }
 
@@ -340,8 +457,41 @@ int newfs_opendir(const char* path, struct fuse_file_info* fi) {
  * @return int 0成功，否则失败
  */
 int newfs_truncate(const char* path, off_t offset) {
-	/* 选做 */
-	return 0;
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_inode*  inode;
+	int		old_blks, nblks, ret;
+	
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+
+	inode = dentry->inode;
+
+	if (NEWFS_IS_DIR(inode)) {
+		return -NEWFS_ERROR_ISDIR;
+	}
+
+	old_blks = inode->blks;
+	if (offset < inode->size) {							/* 缩小时释放新末尾之后的块 */
+		nblks = (offset + NEWFS_BLK_SZ() - 1) / NEWFS_BLK_SZ();
+		newfs_page_trunc(inode, nblks);
+		ret = newfs_bmap_shrink(inode, nblks);
+	}
+	else {
+		ret = newfs_reserve(inode, offset);
+	}
+	if (ret != NEWFS_ERROR_NONE) {
+		return ret;
+	}
+	if (offset > inode->size) {							/* 扩大的部分清零 */
+		ret = newfs_fill_pages(inode, NULL, offset - inode->size, inode->size, old_blks);
+		if (ret != NEWFS_ERROR_NONE) {
+			return ret;
+		}
+	}
+	inode->size = offset;
+	return NEWFS_ERROR_NONE;
 }
 
 
@@ -370,6 +520,7 @@ int main(int argc, char **argv)
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
 	newfs_options.device = strdup("/dev/ddriver");
+	newfs_options.mapping = strdup("extent");
 
 	if (fuse_opt_parse(&args, &newfs_options, option_spec, NULL) == -1)
 		return -1;
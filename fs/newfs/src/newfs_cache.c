@@ -0,0 +1,312 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+/**
+ * @brief 块号所在的哈希桶
+ * 
+ * @param blk
+ * @return struct newfs_buf**
+ */
+static inline struct newfs_buf** newfs_buf_bucket(int blk) {
+    return &newfs_super.buf_hash[blk % NEWFS_BUF_HASH];
+}
+
+/**
+ * @brief 分配NEWFS_BUF_NR个块缓冲，数据区一次性分配
+ * 
+ * @return int
+ */
+int newfs_buf_init() {
+    uint8_t* data;
+    int      i;
+
+    newfs_super.bufs = (struct newfs_buf*)calloc(NEWFS_BUF_NR, sizeof(struct newfs_buf));
+    data = (uint8_t *)malloc(NEWFS_BLKS_SZ(NEWFS_BUF_NR));
+    if (newfs_super.bufs == NULL || data == NULL) {
+        free(newfs_super.bufs);
+        free(data);
+        newfs_super.bufs = NULL;
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (i = 0; i < NEWFS_BUF_NR; i++) {
+        newfs_super.bufs[i].blk  = -1;
+        newfs_super.bufs[i].data = data + NEWFS_BLKS_SZ(i);
+    }
+    memset(newfs_super.buf_hash, 0, sizeof(newfs_super.buf_hash));
+    newfs_super.buf_hand = 0;
+    pthread_mutex_init(&newfs_super.buf_lock, NULL);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放块缓冲，调用前须已newfs_buf_sync
+ */
+void newfs_buf_destroy() {
+    if (newfs_super.bufs == NULL) {
+        return;
+    }
+    free(newfs_super.bufs[0].data);
+    free(newfs_super.bufs);
+    newfs_super.bufs = NULL;
+    pthread_mutex_destroy(&newfs_super.buf_lock);
+}
+
+/**
+ * @brief 在哈希表中查找块缓冲，调用者持有buf_lock
+ * 
+ * @param blk
+ * @return struct newfs_buf* 未缓冲返回NULL
+ */
+static struct newfs_buf* newfs_buf_lookup(int blk) {
+    struct newfs_buf* buf = *newfs_buf_bucket(blk);
+    while (buf != NULL && buf->blk != blk) {
+        buf = buf->hash_next;
+    }
+    return buf;
+}
+
+/**
+ * @brief 将块缓冲移出哈希表并置为空闲，调用者持有buf_lock
+ * 
+ * @param buf
+ */
+static void newfs_buf_unhash(struct newfs_buf* buf) {
+    struct newfs_buf** link = newfs_buf_bucket(buf->blk);
+    while (*link != buf) {
+        link = &(*link)->hash_next;
+    }
+    *link          = buf->hash_next;
+    buf->hash_next = NULL;
+    buf->blk       = -1;
+    buf->flags     = 0;
+}
+
+/**
+ * @brief CLOCK选择换出的块缓冲：跳过使用中的，访问位置位的清零后再给一次机会，调用者持有buf_lock
+ * 
+ * @return struct newfs_buf* 全部使用中返回NULL
+ */
+static struct newfs_buf* newfs_buf_victim() {
+    struct newfs_buf* buf;
+    int    scan;
+
+    for (scan = 0; scan < 2 * NEWFS_BUF_NR; scan++) {
+        buf = &newfs_super.bufs[newfs_super.buf_hand];
+        newfs_super.buf_hand = (newfs_super.buf_hand + 1) % NEWFS_BUF_NR;
+        if (buf->pin > 0) {
+            continue;
+        }
+        if (buf->ref) {
+            buf->ref = 0;
+            continue;
+        }
+        return buf;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 为blk占用一个块缓冲，脏的换出块先写回，内容尚未读入
+ * 
+ * 调用者持有buf_lock，写回期间也不释放，换出块不会被其他线程同时取得或重新标脏
+ * @param blk
+ * @return struct newfs_buf*
+ */
+static struct newfs_buf* newfs_buf_claim(int blk) {
+    struct newfs_buf* buf = newfs_buf_victim();
+
+    if (buf == NULL) {
+        NEWFS_DBG("[%s] all buffers pinned\n", __func__);
+        return NULL;
+    }
+    if (buf->flags & NEWFS_FLAG_BUF_DIRTY) {
+        if (ddriver_pwrite(NEWFS_DRIVER(), (char *)buf->data, NEWFS_BLK_SZ(),
+                           NEWFS_BLKS_SZ(buf->blk)) < 0) {
+            NEWFS_DBG("[%s] write back %d failed\n", __func__, buf->blk);
+            return NULL;
+        }
+    }
+    if (buf->flags & NEWFS_FLAG_BUF_OCCUPY) {
+        newfs_buf_unhash(buf);
+    }
+    buf->blk       = blk;
+    buf->flags     = NEWFS_FLAG_BUF_OCCUPY;
+    buf->ref       = 1;
+    buf->pin       = 1;
+    buf->hash_next = *newfs_buf_bucket(blk);
+    *newfs_buf_bucket(blk) = buf;
+    return buf;
+}
+
+/**
+ * @brief 取得blk的块缓冲并引用，用完须newfs_buf_put
+ * 
+ * @param blk 设备块号
+ * @param fill 未命中时是否从设备读入，调用者将整块覆盖时不必读
+ * @return struct newfs_buf*
+ */
+struct newfs_buf* newfs_buf_get(int blk, boolean fill) {
+    struct newfs_buf* buf;
+
+    pthread_mutex_lock(&newfs_super.buf_lock);
+    buf = newfs_buf_lookup(blk);
+    if (buf != NULL) {
+        buf->ref = 1;
+        buf->pin++;
+        pthread_mutex_unlock(&newfs_super.buf_lock);
+        return buf;
+    }
+    buf = newfs_buf_claim(blk);
+    if (buf != NULL && fill && ddriver_pread(NEWFS_DRIVER(), (char *)buf->data, NEWFS_BLK_SZ(),
+                                             NEWFS_BLKS_SZ(blk)) < 0) {
+        buf->pin = 0;
+        newfs_buf_unhash(buf);
+        buf = NULL;
+    }
+    pthread_mutex_unlock(&newfs_super.buf_lock);
+    return buf;
+}
+
+/**
+ * @brief 批量取得块缓冲，未命中的读请求一次性提交，延迟相互重叠
+ *
+ * 读入期间持有buf_lock，其他线程不会取得尚未读入的缓冲
+ * 
+ * @param blks 设备块号
+ * @param bufs 返回的块缓冲，均已引用
+ * @param cnt
+ * @return int
+ */
+int newfs_buf_get_batch(int* blks, struct newfs_buf** bufs, int cnt) {
+    struct ddriver_req*  reqs  = (struct ddriver_req*)malloc(cnt * sizeof(struct ddriver_req));
+    struct ddriver_req** preqs = (struct ddriver_req**)malloc(cnt * sizeof(struct ddriver_req*));
+    struct newfs_buf**   miss  = (struct newfs_buf**)malloc(cnt * sizeof(struct newfs_buf*));
+    int    nr_miss = 0, ret = NEWFS_ERROR_NONE, i;
+
+    if (reqs == NULL || preqs == NULL || miss == NULL) {
+        free(miss);
+        free(preqs);
+        free(reqs);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    pthread_mutex_lock(&newfs_super.buf_lock);
+    for (i = 0; i < cnt; i++) {
+        bufs[i] = newfs_buf_lookup(blks[i]);
+        if (bufs[i] != NULL) {
+            bufs[i]->ref = 1;
+            bufs[i]->pin++;
+            continue;
+        }
+        bufs[i] = newfs_buf_claim(blks[i]);
+        if (bufs[i] == NULL) {
+            ret = -NEWFS_ERROR_IO;
+            break;
+        }
+        reqs[nr_miss].op     = DDRIVER_OP_READ;
+        reqs[nr_miss].buf    = (char *)bufs[i]->data;
+        reqs[nr_miss].size   = NEWFS_BLK_SZ();
+        reqs[nr_miss].offset = NEWFS_BLKS_SZ(blks[i]);
+        preqs[nr_miss]       = &reqs[nr_miss];
+        miss[nr_miss]        = bufs[i];
+        nr_miss++;
+    }
+    if (ret == NEWFS_ERROR_NONE && nr_miss > 0) {
+        ret = newfs_driver_submit_wait(preqs, nr_miss);
+    }
+    if (ret != NEWFS_ERROR_NONE) {                   /* 放回已引用的缓冲，未读入的作废 */
+        for (i = 0; i < cnt && bufs[i] != NULL; i++) {
+            bufs[i]->pin--;
+        }
+        for (i = 0; i < nr_miss; i++) {
+            newfs_buf_unhash(miss[i]);
+        }
+    }
+    pthread_mutex_unlock(&newfs_super.buf_lock);
+    free(miss);
+    free(preqs);
+    free(reqs);
+    return ret;
+}
+
+/**
+ * @brief 放回块缓冲
+ * 
+ * @param buf
+ */
+void newfs_buf_put(struct newfs_buf* buf) {
+    pthread_mutex_lock(&newfs_super.buf_lock);
+    buf->pin--;
+    pthread_mutex_unlock(&newfs_super.buf_lock);
+}
+
+/**
+ * @brief 标记块缓冲已修改，换出或newfs_buf_sync时写回
+ * 
+ * @param buf
+ */
+void newfs_buf_dirty(struct newfs_buf* buf) {
+    pthread_mutex_lock(&newfs_super.buf_lock);
+    buf->flags |= NEWFS_FLAG_BUF_DIRTY;
+    pthread_mutex_unlock(&newfs_super.buf_lock);
+}
+
+/**
+ * @brief 丢弃blk的缓冲内容，不写回，用于块被释放时
+ * 
+ * @param blk
+ */
+void newfs_buf_forget(int blk) {
+    struct newfs_buf* buf;
+
+    pthread_mutex_lock(&newfs_super.buf_lock);
+    buf = newfs_buf_lookup(blk);
+    if (buf != NULL) {
+        newfs_buf_unhash(buf);
+    }
+    pthread_mutex_unlock(&newfs_super.buf_lock);
+}
+
+static int newfs_buf_cmp(const void* a, const void* b) {
+    return (*(struct newfs_buf**)a)->blk - (*(struct newfs_buf**)b)->blk;
+}
+
+/**
+ * @brief 按块号顺序写回所有脏缓冲，一次性提交给驱动后刷回后端
+ * 
+ * 写回期间持有buf_lock，其间不会有缓冲被标脏后又被当作已写回
+ * @return int
+ */
+int newfs_buf_sync() {
+    struct ddriver_req  reqs[NEWFS_BUF_NR];
+    struct ddriver_req* preqs[NEWFS_BUF_NR];
+    struct newfs_buf*   dirty[NEWFS_BUF_NR];
+    int    nr_dirty = 0, ret = NEWFS_ERROR_NONE, i;
+
+    pthread_mutex_lock(&newfs_super.buf_lock);
+    for (i = 0; i < NEWFS_BUF_NR; i++) {
+        if (newfs_super.bufs[i].flags & NEWFS_FLAG_BUF_DIRTY) {
+            dirty[nr_dirty++] = &newfs_super.bufs[i];
+        }
+    }
+    qsort(dirty, nr_dirty, sizeof(struct newfs_buf*), newfs_buf_cmp);
+    for (i = 0; i < nr_dirty; i++) {
+        reqs[i].op     = DDRIVER_OP_WRITE;
+        reqs[i].buf    = (char *)dirty[i]->data;
+        reqs[i].size   = NEWFS_BLK_SZ();
+        reqs[i].offset = NEWFS_BLKS_SZ(dirty[i]->blk);
+        preqs[i]       = &reqs[i];
+    }
+    if (nr_dirty > 0 && newfs_driver_submit_wait(preqs, nr_dirty) != NEWFS_ERROR_NONE) {
+        NEWFS_DBG("[%s] io error\n", __func__);
+        ret = -NEWFS_ERROR_IO;
+    }
+    for (i = 0; i < nr_dirty && ret == NEWFS_ERROR_NONE; i++) {
+        dirty[i]->flags &= ~NEWFS_FLAG_BUF_DIRTY;
+    }
+    if (ret == NEWFS_ERROR_NONE && ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_FLUSH, NULL) < 0) {
+        ret = -NEWFS_ERROR_IO;
+    }
+    pthread_mutex_unlock(&newfs_super.buf_lock);
+    return ret;
+}
@@ -0,0 +1,430 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+#define NEWFS_EXT_FULL            1                   /* 子树已满，需由上层分裂 */
+
+/**
+ * @brief 取得区段树节点所在数据块的缓冲
+ *
+ * @param dno 节点的数据块号
+ * @param fill 新建节点时不必读入
+ * @return struct newfs_buf*
+ */
+static struct newfs_buf* newfs_ext_node(int dno, boolean fill) {
+    return newfs_buf_get(NEWFS_DATA_BLK(dno), fill);
+}
+
+/**
+ * @brief 将inode的映射区初始化为空的区段树
+ *
+ * @param inode
+ */
+void newfs_ext_init(struct newfs_inode* inode) {
+    struct newfs_extent_hdr* root = NEWFS_EXT_HDR(inode->block);
+
+    memset(inode->block, 0, sizeof(inode->block));
+    root->magic   = NEWFS_EXT_MAGIC;
+    root->max     = NEWFS_EXT_ROOT_MAX;
+    root->depth   = 0;
+    root->entries = 0;
+    inode->flags |= NEWFS_INODE_EXTENTS;
+}
+
+/**
+ * @brief 查找逻辑块对应的数据块，自根沿索引逐层下降
+ *
+ * @param inode
+ * @param lblk 逻辑块号
+ * @param run 返回自lblk起物理连续的块数，可为NULL
+ * @return int 数据块号，未映射返回-1
+ */
+int newfs_ext_map(struct newfs_inode* inode, int lblk, int* run) {
+    struct newfs_extent_hdr* hdr = NEWFS_EXT_HDR(inode->block);
+    struct newfs_extent*     ext;
+    struct newfs_buf*        buf = NULL;
+    struct newfs_buf*        next;
+    int    i, dno = -1;
+
+    while (hdr->depth > 0) {
+        for (i = hdr->entries - 1; i > 0 && NEWFS_EXT_INDEX(hdr, i)->lblk > lblk; i--);
+        next = newfs_ext_node(NEWFS_EXT_INDEX(hdr, i)->leaf, TRUE);
+        if (buf != NULL) {
+            newfs_buf_put(buf);
+        }
+        if (next == NULL) {
+            return -1;
+        }
+        buf = next;
+        hdr = NEWFS_EXT_HDR(buf->data);
+    }
+    for (i = 0; i < hdr->entries; i++) {
+        ext = NEWFS_EXT_ENTRY(hdr, i);
+        if (lblk >= ext->lblk && lblk < ext->lblk + ext->len) {
+            dno = ext->start + lblk - ext->lblk;
+            if (run != NULL) {
+                *run = ext->lblk + ext->len - lblk;
+            }
+            break;
+        }
+    }
+    if (buf != NULL) {
+        newfs_buf_put(buf);
+    }
+    return dno;
+}
+
+/**
+ * @brief 新建一条深度为depth的节点链，最底层的叶子只含ext
+ *
+ * @param depth
+ * @param ext
+ * @return int 链顶节点的数据块号，负数为失败
+ */
+static int newfs_ext_new_node(int depth, struct newfs_extent* ext) {
+    struct newfs_extent_hdr* hdr;
+    struct newfs_buf*        buf;
+    int    dno, child, got;
+
+    dno = newfs_alloc_data(ext->start, 1, &got);        /* 节点尽量靠近它映射的数据 */
+    if (dno < 0) {
+        return dno;
+    }
+    buf = newfs_ext_node(dno, FALSE);
+    if (buf == NULL) {
+        newfs_drop_data(dno);
+        return -NEWFS_ERROR_IO;
+    }
+    memset(buf->data, 0, NEWFS_BLK_SZ());
+    hdr = NEWFS_EXT_HDR(buf->data);
+    hdr->magic   = NEWFS_EXT_MAGIC;
+    hdr->max     = NEWFS_EXT_NODE_MAX();
+    hdr->depth   = depth;
+    hdr->entries = 1;
+    if (depth == 0) {
+        *NEWFS_EXT_ENTRY(hdr, 0) = *ext;
+    }
+    else {
+        child = newfs_ext_new_node(depth - 1, ext);
+        if (child < 0) {
+            newfs_buf_put(buf);
+            newfs_drop_data(dno);
+            return child;
+        }
+        NEWFS_EXT_INDEX(hdr, 0)->lblk = ext->lblk;
+        NEWFS_EXT_INDEX(hdr, 0)->leaf = child;
+    }
+    newfs_buf_dirty(buf);
+    newfs_buf_put(buf);
+    return dno;
+}
+
+/**
+ * @brief 在以hdr为根的子树最右侧追加区段，与最后一个区段物理相邻时直接延长
+ *
+ * 文件只在末尾增长，区段按逻辑块号有序，追加总发生在最右侧路径上
+ * @param hdr
+ * @param ext
+ * @return int 0成功，NEWFS_EXT_FULL表示子树已满，负数为失败
+ */
+static int newfs_ext_append_node(struct newfs_extent_hdr* hdr, struct newfs_extent* ext) {
+    struct newfs_extent* last;
+    struct newfs_buf*    buf;
+    int    ret, dno;
+
+    if (hdr->depth == 0) {
+        if (hdr->entries > 0) {
+            last = NEWFS_EXT_ENTRY(hdr, hdr->entries - 1);
+            if (last->lblk + last->len == ext->lblk && last->start + last->len == ext->start) {
+                last->len += ext->len;
+                return NEWFS_ERROR_NONE;
+            }
+        }
+        if (hdr->entries == hdr->max) {
+            return NEWFS_EXT_FULL;
+        }
+        *NEWFS_EXT_ENTRY(hdr, hdr->entries++) = *ext;
+        return NEWFS_ERROR_NONE;
+    }
+
+    buf = newfs_ext_node(NEWFS_EXT_INDEX(hdr, hdr->entries - 1)->leaf, TRUE);
+    if (buf == NULL) {
+        return -NEWFS_ERROR_IO;
+    }
+    ret = newfs_ext_append_node(NEWFS_EXT_HDR(buf->data), ext);
+    if (ret == NEWFS_ERROR_NONE) {
+        newfs_buf_dirty(buf);
+    }
+    newfs_buf_put(buf);
+    if (ret != NEWFS_EXT_FULL) {
+        return ret;
+    }
+    if (hdr->entries == hdr->max) {
+        return NEWFS_EXT_FULL;
+    }
+    dno = newfs_ext_new_node(hdr->depth - 1, ext);      /* 右侧新开一棵子树 */
+    if (dno < 0) {
+        return dno;
+    }
+    NEWFS_EXT_INDEX(hdr, hdr->entries)->lblk = ext->lblk;
+    NEWFS_EXT_INDEX(hdr, hdr->entries)->leaf = dno;
+    hdr->entries++;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将物理连续的一段数据块映射到文件末尾，根满时整棵树长高一层
+ *
+ * @param inode
+ * @param lblk 起始逻辑块号，须等于当前已映射块数
+ * @param start 起始数据块号
+ * @param len
+ * @return int
+ */
+int newfs_ext_append(struct newfs_inode* inode, int lblk, int start, int len) {
+    struct newfs_extent_hdr* root = NEWFS_EXT_HDR(inode->block);
+    struct newfs_extent_hdr* hdr;
+    struct newfs_extent      ext = { .lblk = lblk, .len = len, .start = start };
+    struct newfs_buf*        buf;
+    int    ret, dno, got;
+
+    ret = newfs_ext_append_node(root, &ext);
+    if (ret != NEWFS_EXT_FULL) {
+        return ret;
+    }
+
+    dno = newfs_alloc_data(start, 1, &got);             /* 根的表项移入新节点 */
+    if (dno < 0) {
+        return dno;
+    }
+    buf = newfs_ext_node(dno, FALSE);
+    if (buf == NULL) {
+        newfs_drop_data(dno);
+        return -NEWFS_ERROR_IO;
+    }
+    memset(buf->data, 0, NEWFS_BLK_SZ());
+    hdr = NEWFS_EXT_HDR(buf->data);
+    memcpy(hdr, root, sizeof(struct newfs_extent_hdr) + root->entries * sizeof(struct newfs_extent));
+    hdr->max = NEWFS_EXT_NODE_MAX();
+    newfs_buf_dirty(buf);
+    newfs_buf_put(buf);
+
+    NEWFS_EXT_INDEX(root, 0)->lblk = NEWFS_EXT_ENTRY(root, 0)->lblk;   /* 两种表项都以lblk开头 */
+    NEWFS_EXT_INDEX(root, 0)->leaf = dno;
+    root->entries = 1;
+    root->depth++;
+    return newfs_ext_append_node(root, &ext);
+}
+
+/**
+ * @brief 按逻辑顺序收集子树中与[from, to)相交的区段，只下降到相交的子节点
+ *
+ * @param hdr
+ * @param from
+ * @param to
+ * @param exts 结果数组，按需扩容
+ * @param nr
+ * @param cap
+ * @return int
+ */
+static int newfs_ext_walk(struct newfs_extent_hdr* hdr, int from, int to,
+                          struct newfs_extent** exts, int* nr, int* cap) {
+    struct newfs_extent* ext;
+    struct newfs_extent* grown;
+    struct newfs_buf*    buf;
+    int    i, ret;
+
+    if (hdr->depth == 0) {
+        for (i = 0; i < hdr->entries; i++) {
+            ext = NEWFS_EXT_ENTRY(hdr, i);
+            if (ext->lblk + ext->len <= from || ext->lblk >= to) {
+                continue;
+            }
+            if (*nr == *cap) {
+                grown = (struct newfs_extent*)realloc(*exts, (*cap == 0 ? 4 : *cap * 2) * sizeof(struct newfs_extent));
+                if (grown == NULL) {
+                    return -NEWFS_ERROR_NOSPACE;
+                }
+                *exts = grown;
+                *cap  = *cap == 0 ? 4 : *cap * 2;
+            }
+            (*exts)[(*nr)++] = *ext;
+        }
+        return NEWFS_ERROR_NONE;
+    }
+    for (i = 0; i < hdr->entries; i++) {              /* 第i个子树覆盖[lblk_i, lblk_i+1) */
+        if (i + 1 < hdr->entries && NEWFS_EXT_INDEX(hdr, i + 1)->lblk <= from) {
+            continue;
+        }
+        if (NEWFS_EXT_INDEX(hdr, i)->lblk >= to) {
+            break;
+        }
+        buf = newfs_ext_node(NEWFS_EXT_INDEX(hdr, i)->leaf, TRUE);
+        if (buf == NULL) {
+            return -NEWFS_ERROR_IO;
+        }
+        ret = newfs_ext_walk(NEWFS_EXT_HDR(buf->data), from, to, exts, nr, cap);
+        newfs_buf_put(buf);
+        if (ret != NEWFS_ERROR_NONE) {
+            return ret;
+        }
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 收集inode中与逻辑块范围[from, to)相交的区段，用于读写一段文件内容
+ *
+ * @param inode
+ * @param from
+ * @param to
+ * @param exts 返回malloc的数组，由调用者释放
+ * @return int 区段个数，负数为失败
+ */
+int newfs_ext_collect(struct newfs_inode* inode, int from, int to, struct newfs_extent** exts) {
+    int nr = 0, cap = 0, ret;
+
+    *exts = NULL;
+    ret = newfs_ext_walk(NEWFS_EXT_HDR(inode->block), from, to, exts, &nr, &cap);
+    if (ret != NEWFS_ERROR_NONE) {
+        free(*exts);
+        *exts = NULL;
+        return ret;
+    }
+    return nr;
+}
+
+/**
+ * @brief 已映射的逻辑块数，即最右侧区段的末尾
+ *
+ * @param inode
+ * @return int
+ */
+int newfs_ext_blks(struct newfs_inode* inode) {
+    struct newfs_extent_hdr* hdr = NEWFS_EXT_HDR(inode->block);
+    struct newfs_extent*     last;
+    struct newfs_buf*        buf = NULL;
+    struct newfs_buf*        next;
+    int    blks = 0;
+
+    while (hdr->depth > 0) {
+        next = newfs_ext_node(NEWFS_EXT_INDEX(hdr, hdr->entries - 1)->leaf, TRUE);
+        if (buf != NULL) {
+            newfs_buf_put(buf);
+        }
+        if (next == NULL) {
+            return -NEWFS_ERROR_IO;
+        }
+        buf = next;
+        hdr = NEWFS_EXT_HDR(buf->data);
+    }
+    if (hdr->entries > 0) {
+        last = NEWFS_EXT_ENTRY(hdr, hdr->entries - 1);
+        blks = last->lblk + last->len;
+    }
+    if (buf != NULL) {
+        newfs_buf_put(buf);
+    }
+    return blks;
+}
+
+/**
+ * @brief 将文件映射扩展到nblks块，每次分配尽量长的连续空闲段并紧接上一段
+ *
+ * @param inode
+ * @param nblks
+ * @return int
+ */
+int newfs_ext_grow(struct newfs_inode* inode, int nblks) {
+    int goal, start, got, ret, i;
+
+    while (inode->blks < nblks) {
+        goal  = inode->blks > 0 ? newfs_ext_map(inode, inode->blks - 1, NULL) + 1 : 0;
+        start = newfs_alloc_data(goal, nblks - inode->blks, &got);
+        if (start < 0) {
+            return start;
+        }
+        ret = newfs_ext_append(inode, inode->blks, start, got);
+        if (ret != NEWFS_ERROR_NONE) {
+            for (i = 0; i < got; i++) {
+                newfs_drop_data(start + i);
+            }
+            return ret;
+        }
+        inode->blks += got;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放子树中逻辑块nblks及之后的映射，整棵落在其后的子树连同节点块一并释放
+ *
+ * 子树的第一个区段从其索引的lblk开始，索引lblk小于nblks的子树截断后仍非空
+ * @param hdr
+ * @param nblks
+ * @return int
+ */
+static int newfs_ext_shrink_node(struct newfs_extent_hdr* hdr, int nblks) {
+    struct newfs_extent* ext;
+    struct newfs_buf*    buf;
+    int    ret, dno, keep, i;
+
+    if (hdr->depth == 0) {
+        while (hdr->entries > 0) {
+            ext = NEWFS_EXT_ENTRY(hdr, hdr->entries - 1);
+            if (ext->lblk + ext->len <= nblks) {
+                break;
+            }
+            keep = ext->lblk >= nblks ? 0 : nblks - ext->lblk;
+            for (i = keep; i < ext->len; i++) {
+                newfs_drop_data(ext->start + i);
+            }
+            ext->len = keep;
+            if (keep == 0) {
+                hdr->entries--;
+            }
+        }
+        return NEWFS_ERROR_NONE;
+    }
+    while (hdr->entries > 0) {
+        dno = NEWFS_EXT_INDEX(hdr, hdr->entries - 1)->leaf;
+        buf = newfs_ext_node(dno, TRUE);
+        if (buf == NULL) {
+            return -NEWFS_ERROR_IO;
+        }
+        ret = newfs_ext_shrink_node(NEWFS_EXT_HDR(buf->data), nblks);
+        newfs_buf_dirty(buf);
+        newfs_buf_put(buf);
+        if (ret != NEWFS_ERROR_NONE || NEWFS_EXT_INDEX(hdr, hdr->entries - 1)->lblk < nblks) {
+            return ret;
+        }
+        newfs_drop_data(dno);
+        hdr->entries--;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将文件映射截断到nblks块，释放其后的数据块和变空的节点块
+ *
+ * @param inode
+ * @param nblks
+ * @return int
+ */
+int newfs_ext_shrink(struct newfs_inode* inode, int nblks) {
+    struct newfs_extent_hdr* root = NEWFS_EXT_HDR(inode->block);
+    int    ret;
+
+    if (nblks >= inode->blks) {
+        return NEWFS_ERROR_NONE;
+    }
+    ret = newfs_ext_shrink_node(root, nblks);
+    if (ret != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    if (root->entries == 0) {                         /* 树空了，回到深度0的根 */
+        newfs_ext_init(inode);
+    }
+    inode->blks = nblks;
+    return NEWFS_ERROR_NONE;
+}
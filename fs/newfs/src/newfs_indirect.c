@@ -0,0 +1,315 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+/**
+ * @brief 将inode的映射区初始化为ext2式的块指针，全部为空
+ *
+ * @param inode
+ */
+void newfs_ind_init(struct newfs_inode* inode) {
+    memset(inode->block, 0, sizeof(inode->block));
+    inode->flags &= ~NEWFS_INODE_EXTENTS;
+}
+
+/**
+ * @brief 分配一个清零的间接块
+ *
+ * @param goal 期望的数据块号
+ * @return uint32_t 间接块的设备块号，0为失败
+ */
+static uint32_t newfs_ind_new_block(int goal) {
+    struct newfs_buf* buf;
+    int    dno, got;
+
+    dno = newfs_alloc_data(goal, 1, &got);
+    if (dno < 0) {
+        return 0;
+    }
+    buf = newfs_buf_get(NEWFS_DATA_BLK(dno), FALSE);
+    if (buf == NULL) {
+        newfs_drop_data(dno);
+        return 0;
+    }
+    memset(buf->data, 0, NEWFS_BLK_SZ());
+    newfs_buf_dirty(buf);
+    newfs_buf_put(buf);
+    return NEWFS_DATA_BLK(dno);
+}
+
+/**
+ * @brief 找到存放逻辑块lblk指针的槽位，至多经过三层间接块
+ *
+ * 0~11直接指向数据块，其后依次经一、二、三级间接块。槽位在间接块中时，
+ * 该间接块的缓冲经buf返回并保持引用，调用者修改槽位后须标脏，用完须放回
+ * @param inode
+ * @param lblk 逻辑块号
+ * @param goal 非负时按需分配途经的间接块，为期望的数据块号；负数时只查找
+ * @param buf 返回槽位所在的块缓冲，槽位在inode中时为NULL
+ * @return uint32_t* 槽位，途经的间接块不存在或分配失败时为NULL
+ */
+static uint32_t* newfs_ind_slot(struct newfs_inode* inode, int lblk, int goal,
+                                struct newfs_buf** buf) {
+    uint32_t*         slot;
+    struct newfs_buf* next;
+    int    per = NEWFS_ADDR_PER_BLK();
+    int    path[NEWFS_IND_LEVELS];
+    int    level = 0, span, i;
+
+    *buf = NULL;
+    if (lblk < NEWFS_NDIR_BLOCKS) {
+        return &inode->block[lblk];
+    }
+    lblk -= NEWFS_NDIR_BLOCKS;
+    for (level = 1; level <= NEWFS_IND_LEVELS; level++) {      /* 第level级可寻址per^level块 */
+        for (span = 1, i = 0; i < level; i++) {
+            span *= per;
+        }
+        if (lblk < span) {
+            break;
+        }
+        lblk -= span;
+    }
+    if (level > NEWFS_IND_LEVELS) {
+        return NULL;
+    }
+    for (i = level - 1; i >= 0; i--) {
+        path[i] = lblk % per;
+        lblk   /= per;
+    }
+
+    slot = &inode->block[NEWFS_NDIR_BLOCKS + level - 1];
+    for (i = 0; i < level; i++) {
+        if (*slot == 0) {
+            if (goal < 0 || (*slot = newfs_ind_new_block(goal)) == 0) {
+                if (*buf != NULL) {
+                    newfs_buf_put(*buf);
+                    *buf = NULL;
+                }
+                return NULL;
+            }
+            if (*buf != NULL) {
+                newfs_buf_dirty(*buf);
+            }
+        }
+        next = newfs_buf_get(*slot, TRUE);
+        if (*buf != NULL) {
+            newfs_buf_put(*buf);
+        }
+        *buf = next;
+        if (next == NULL) {
+            return NULL;
+        }
+        slot = (uint32_t *)next->data + path[i];
+    }
+    return slot;
+}
+
+/**
+ * @brief 查找逻辑块对应的数据块
+ *
+ * @param inode
+ * @param lblk 逻辑块号
+ * @return int 数据块号，未映射返回-1
+ */
+int newfs_ind_map(struct newfs_inode* inode, int lblk) {
+    struct newfs_buf* buf;
+    uint32_t*         slot = newfs_ind_slot(inode, lblk, -1, &buf);
+    int    dno = -1;
+
+    if (slot != NULL && *slot != 0) {
+        dno = NEWFS_BLK_DNO(*slot);
+    }
+    if (buf != NULL) {
+        newfs_buf_put(buf);
+    }
+    return dno;
+}
+
+/**
+ * @brief 已映射的逻辑块数，文件只在末尾增长，即第一个空指针的位置
+ *
+ * 倍增找到上界后二分，每次探测至多经过三级间接块
+ * @param inode
+ * @return int
+ */
+int newfs_ind_blks(struct newfs_inode* inode) {
+    int lo = 0, hi = 1, mid;
+
+    while (newfs_ind_map(inode, hi - 1) >= 0) {       /* 倍增找到上界 */
+        lo = hi;
+        hi *= 2;
+    }
+    while (lo < hi - 1) {                             /* [0, lo)已映射，hi-1未映射 */
+        mid = (lo + hi) / 2;
+        if (newfs_ind_map(inode, mid - 1) >= 0) {
+            lo = mid;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief 收集逻辑块范围[from, to)内的映射，物理相邻的块合并为一个区段
+ *
+ * @param inode
+ * @param from
+ * @param to
+ * @param exts 返回malloc的数组，由调用者释放
+ * @return int 区段个数，负数为失败
+ */
+int newfs_ind_collect(struct newfs_inode* inode, int from, int to, struct newfs_extent** exts) {
+    struct newfs_extent* last = NULL;
+    struct newfs_extent* grown;
+    int    nr = 0, cap = 0, lblk, dno;
+
+    *exts = NULL;
+    to = to < inode->blks ? to : inode->blks;
+    for (lblk = from; lblk < to; lblk++) {
+        dno = newfs_ind_map(inode, lblk);
+        if (dno < 0) {
+            free(*exts);
+            *exts = NULL;
+            return -NEWFS_ERROR_IO;
+        }
+        if (last != NULL && last->start + last->len == dno) {
+            last->len++;
+            continue;
+        }
+        if (nr == cap) {
+            cap   = cap == 0 ? 4 : cap * 2;
+            grown = (struct newfs_extent*)realloc(*exts, cap * sizeof(struct newfs_extent));
+            if (grown == NULL) {
+                free(*exts);
+                *exts = NULL;
+                return -NEWFS_ERROR_NOSPACE;
+            }
+            *exts = grown;
+        }
+        last        = *exts + nr++;
+        last->lblk  = lblk;
+        last->len   = 1;
+        last->start = dno;
+    }
+    return nr;
+}
+
+/**
+ * @brief 将文件映射扩展到nblks块，数据块尽量连续分配，间接块在需要时插在其间
+ *
+ * @param inode
+ * @param nblks
+ * @return int
+ */
+int newfs_ind_grow(struct newfs_inode* inode, int nblks) {
+    struct newfs_buf* buf;
+    uint32_t*         slot;
+    int    goal, start, got, i;
+
+    while (inode->blks < nblks) {
+        goal  = inode->blks > 0 ? newfs_ind_map(inode, inode->blks - 1) + 1 : 0;
+        start = newfs_alloc_data(goal, nblks - inode->blks, &got);
+        if (start < 0) {
+            return start;
+        }
+        for (i = 0; i < got; i++) {
+            slot = newfs_ind_slot(inode, inode->blks, start + got, &buf);
+            if (slot == NULL) {                       /* 未挂上的块放回 */
+                for (; i < got; i++) {
+                    newfs_drop_data(start + i);
+                }
+                return -NEWFS_ERROR_NOSPACE;
+            }
+            *slot = NEWFS_DATA_BLK(start + i);
+            if (buf != NULL) {
+                newfs_buf_dirty(buf);
+                newfs_buf_put(buf);
+            }
+            inode->blks++;
+        }
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放槽位所指子树中逻辑块nblks及之后的块，子树整棵落在其后时连同间接块释放并清空槽位
+ *
+ * @param slot 指向数据块或间接块的槽位
+ * @param level 槽位以下的间接层数，0表示直接指向数据块
+ * @param base 子树的第一个逻辑块号
+ * @param nblks
+ * @return int
+ */
+static int newfs_ind_shrink_slot(uint32_t* slot, int level, int base, int nblks) {
+    struct newfs_buf* buf;
+    uint32_t*         slots;
+    int    per = NEWFS_ADDR_PER_BLK();
+    int    span = 1, ret = NEWFS_ERROR_NONE, i;
+
+    if (*slot == 0) {
+        return NEWFS_ERROR_NONE;
+    }
+    if (level > 0) {
+        for (i = 1; i < level; i++) {                 /* 每个子槽位覆盖per^(level-1)块 */
+            span *= per;
+        }
+        buf = newfs_buf_get(*slot, TRUE);
+        if (buf == NULL) {
+            return -NEWFS_ERROR_IO;
+        }
+        slots = (uint32_t *)buf->data;
+        for (i = per - 1; i >= 0 && ret == NEWFS_ERROR_NONE; i--) {
+            if (base + i * span + span <= nblks) {
+                break;
+            }
+            ret = newfs_ind_shrink_slot(&slots[i], level - 1, base + i * span, nblks);
+        }
+        newfs_buf_dirty(buf);
+        newfs_buf_put(buf);
+        if (ret != NEWFS_ERROR_NONE) {
+            return ret;
+        }
+    }
+    if (base >= nblks) {
+        newfs_drop_data(NEWFS_BLK_DNO(*slot));
+        *slot = 0;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将文件映射截断到nblks块，释放其后的数据块和变空的间接块
+ *
+ * @param inode
+ * @param nblks
+ * @return int
+ */
+int newfs_ind_shrink(struct newfs_inode* inode, int nblks) {
+    int    per = NEWFS_ADDR_PER_BLK();
+    int    base = NEWFS_NDIR_BLOCKS, span = 1, ret, level, i;
+
+    if (nblks >= inode->blks) {
+        return NEWFS_ERROR_NONE;
+    }
+    for (i = nblks; i < NEWFS_NDIR_BLOCKS; i++) {
+        ret = newfs_ind_shrink_slot(&inode->block[i], 0, i, nblks);
+        if (ret != NEWFS_ERROR_NONE) {
+            return ret;
+        }
+    }
+    for (level = 1; level <= NEWFS_IND_LEVELS && base < inode->blks; level++) {
+        span *= per;
+        if (base + span > nblks) {
+            ret = newfs_ind_shrink_slot(&inode->block[NEWFS_NDIR_BLOCKS + level - 1], level, base, nblks);
+            if (ret != NEWFS_ERROR_NONE) {
+                return ret;
+            }
+        }
+        base += span;
+    }
+    inode->blks = nblks;
+    return NEWFS_ERROR_NONE;
+}
@@ -0,0 +1,261 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+/**
+ * @brief 保证页表能容纳第lblk页，新增的槽位为未载入，调用者持有page_lock
+ *
+ * 扩容会移动页表，之前取得的&inode->pages[i]随之失效，须重新索引
+ * @param inode
+ * @param lblk
+ * @return int
+ */
+static int newfs_page_reserve(struct newfs_inode* inode, int lblk) {
+    struct newfs_page* pages;
+    int nr = inode->nr_pages, cap;
+
+    if (lblk < nr) {
+        return NEWFS_ERROR_NONE;
+    }
+    cap   = lblk + 1 > 2 * nr ? lblk + 1 : 2 * nr;
+    pages = (struct newfs_page*)realloc(inode->pages, cap * sizeof(struct newfs_page));
+    if (pages == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    memset(pages + nr, 0, (cap - nr) * sizeof(struct newfs_page));
+    inode->pages    = pages;
+    inode->nr_pages = cap;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 对区段中满足条件的连续页各发一个请求，多页的经临时缓冲整段读写，调用者持有page_lock
+ *
+ * @param inode
+ * @param op DDRIVER_OP_READ读未载入的页 / DDRIVER_OP_WRITE写脏页
+ * @param from 逻辑块范围[from, to)
+ * @param to
+ * @return int
+ */
+static int newfs_page_io(struct newfs_inode* inode, int op, int from, int to) {
+    struct newfs_extent*  exts;
+    struct ddriver_req*   reqs  = NULL;
+    struct ddriver_req**  preqs = NULL;
+    struct ddriver_req*   grown;
+    struct newfs_page*    page;
+    int*   lblks = NULL;
+    int*   grown_lblks;
+    int    nr_exts, nr = 0, cap = 0, ret = NEWFS_ERROR_NONE, lblk, end, run, i, j;
+
+    nr_exts = newfs_bmap_collect(inode, from, to, &exts);
+    if (nr_exts < 0) {
+        return nr_exts;
+    }
+    for (i = 0; i < nr_exts && ret == NEWFS_ERROR_NONE; i++) {
+        lblk = exts[i].lblk > from ? exts[i].lblk : from;
+        end  = exts[i].lblk + exts[i].len < to ? exts[i].lblk + exts[i].len : to;
+        while (lblk < end) {
+            for (run = 0; lblk + run < end; run++) {  /* 区段内物理连续，找出满足条件的一段 */
+                page = &inode->pages[lblk + run];
+                if (op == DDRIVER_OP_READ ? page->data != NULL : !page->is_dirty) {
+                    break;
+                }
+            }
+            if (run == 0) {
+                lblk++;
+                continue;
+            }
+            if (nr == cap) {
+                cap         = cap == 0 ? 8 : cap * 2;
+                grown       = (struct ddriver_req*)realloc(reqs, cap * sizeof(struct ddriver_req));
+                reqs        = grown != NULL ? grown : reqs;
+                grown_lblks = (int*)realloc(lblks, cap * sizeof(int));
+                lblks       = grown_lblks != NULL ? grown_lblks : lblks;
+                if (grown == NULL || grown_lblks == NULL) {
+                    ret = -NEWFS_ERROR_NOSPACE;
+                    break;
+                }
+            }
+            reqs[nr].op     = op;
+            reqs[nr].buf    = (char *)malloc(NEWFS_BLKS_SZ(run));
+            reqs[nr].size   = NEWFS_BLKS_SZ(run);
+            reqs[nr].offset = NEWFS_DATA_OFS(exts[i].start + lblk - exts[i].lblk);
+            lblks[nr]       = lblk;
+            if (reqs[nr].buf == NULL) {
+                ret = -NEWFS_ERROR_NOSPACE;
+                break;
+            }
+            if (op == DDRIVER_OP_WRITE) {
+                for (j = 0; j < run; j++) {
+                    memcpy(reqs[nr].buf + NEWFS_BLKS_SZ(j), inode->pages[lblk + j].data, NEWFS_BLK_SZ());
+                }
+            }
+            nr++;
+            lblk += run;
+        }
+    }
+    free(exts);
+
+    if (ret == NEWFS_ERROR_NONE && nr > 0) {
+        preqs = (struct ddriver_req**)malloc(nr * sizeof(struct ddriver_req*));
+        if (preqs == NULL) {
+            ret = -NEWFS_ERROR_NOSPACE;
+        }
+        for (i = 0; i < nr && preqs != NULL; i++) {
+            preqs[i] = &reqs[i];
+        }
+        if (preqs != NULL) {
+            ret = newfs_driver_submit_wait(preqs, nr);
+        }
+    }
+    for (i = 0; i < nr; i++) {
+        for (j = 0; j < (int)(reqs[i].size / NEWFS_BLK_SZ()) && ret == NEWFS_ERROR_NONE; j++) {
+            page = &inode->pages[lblks[i] + j];
+            if (op == DDRIVER_OP_WRITE) {
+                page->is_dirty = FALSE;
+                continue;
+            }
+            page->data = (uint8_t *)malloc(NEWFS_BLK_SZ());
+            if (page->data == NULL) {                 /* 已载入的页保留，其余仍为未载入 */
+                ret = -NEWFS_ERROR_NOSPACE;
+                break;
+            }
+            memcpy(page->data, reqs[i].buf + NEWFS_BLKS_SZ(j), NEWFS_BLK_SZ());
+        }
+        free(reqs[i].buf);
+    }
+    free(preqs);
+    free(lblks);
+    free(reqs);
+    return ret;
+}
+
+/**
+ * @brief 载入[lblk, lblk+cnt)中尚未载入的页，调用者持有page_lock
+ *
+ * @param inode
+ * @param lblk
+ * @param cnt
+ * @return int
+ */
+static int newfs_page_load(struct newfs_inode* inode, int lblk, int cnt) {
+    int end = lblk + cnt < inode->blks ? lblk + cnt : inode->blks;
+    int ret;
+
+    if (lblk >= end) {
+        return NEWFS_ERROR_NONE;
+    }
+    ret = newfs_page_reserve(inode, end - 1);
+    if (ret != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    return newfs_page_io(inode, DDRIVER_OP_READ, lblk, end);
+}
+
+/**
+ * @brief 载入[lblk, lblk+cnt)中尚未载入的页，物理连续的一次读入
+ *
+ * 只读已映射的块，其余页由newfs_page_get按需清零
+ * @param inode
+ * @param lblk
+ * @param cnt
+ * @return int
+ */
+int newfs_page_read(struct newfs_inode* inode, int lblk, int cnt) {
+    int ret;
+
+    pthread_mutex_lock(&inode->page_lock);
+    ret = newfs_page_load(inode, lblk, cnt);
+    pthread_mutex_unlock(&inode->page_lock);
+    return ret;
+}
+
+/**
+ * @brief 取得文件第lblk页，未载入时按需读入
+ *
+ * 页的内容单独分配，页表扩容不会移动它，返回后可在锁外使用
+ * @param inode
+ * @param lblk
+ * @param fill 是否从设备读入，新映射的块或将整页覆盖时不必读，直接清零
+ * @return uint8_t* NEWFS_BLK_SZ字节，读失败返回NULL
+ */
+uint8_t* newfs_page_get(struct newfs_inode* inode, int lblk, boolean fill) {
+    struct newfs_page* page;
+    uint8_t*           data = NULL;
+
+    pthread_mutex_lock(&inode->page_lock);
+    if (newfs_page_reserve(inode, lblk) != NEWFS_ERROR_NONE) {
+        pthread_mutex_unlock(&inode->page_lock);
+        return NULL;
+    }
+    if (inode->pages[lblk].data == NULL && fill &&
+        newfs_page_load(inode, lblk, 1) != NEWFS_ERROR_NONE) {
+        pthread_mutex_unlock(&inode->page_lock);
+        return NULL;
+    }
+    page = &inode->pages[lblk];
+    if (page->data == NULL) {
+        page->data = (uint8_t *)calloc(1, NEWFS_BLK_SZ());
+    }
+    data = page->data;
+    pthread_mutex_unlock(&inode->page_lock);
+    return data;
+}
+
+/**
+ * @brief 标记第lblk页已修改，页须已映射，刷回时写入
+ *
+ * @param inode
+ * @param lblk
+ */
+void newfs_page_dirty(struct newfs_inode* inode, int lblk) {
+    pthread_mutex_lock(&inode->page_lock);
+    inode->pages[lblk].is_dirty = TRUE;
+    inode->is_dirty = TRUE;
+    pthread_mutex_unlock(&inode->page_lock);
+}
+
+/**
+ * @brief 写回inode的全部脏页，物理连续的一段为一个请求，一次性提交
+ *
+ * @param inode
+ * @return int
+ */
+int newfs_page_sync(struct newfs_inode* inode) {
+    int from = 0, to, ret = NEWFS_ERROR_NONE;
+
+    pthread_mutex_lock(&inode->page_lock);
+    if (inode->is_dirty) {
+        to = inode->nr_pages;
+        while (from < to && !inode->pages[from].is_dirty) {   /* 只收集脏页所在范围的映射 */
+            from++;
+        }
+        while (to > from && !inode->pages[to - 1].is_dirty) {
+            to--;
+        }
+        ret = newfs_page_io(inode, DDRIVER_OP_WRITE, from, to);
+        if (ret == NEWFS_ERROR_NONE) {
+            inode->is_dirty = FALSE;
+        }
+    }
+    pthread_mutex_unlock(&inode->page_lock);
+    return ret;
+}
+
+/**
+ * @brief 丢弃第nblks页及之后的页，脏页不再写回，其数据块即将释放
+ *
+ * @param inode
+ * @param nblks
+ */
+void newfs_page_trunc(struct newfs_inode* inode, int nblks) {
+    int lblk;
+
+    pthread_mutex_lock(&inode->page_lock);
+    for (lblk = nblks; lblk < inode->nr_pages; lblk++) {
+        free(inode->pages[lblk].data);
+        inode->pages[lblk].data     = NULL;
+        inode->pages[lblk].is_dirty = FALSE;
+    }
+    pthread_mutex_unlock(&inode->page_lock);
+}
@@ -41,7 +41,7 @@ int newfs_calc_lvl(const char * path) {
 }
 
 /**
- * @brief 驱动读
+ * @brief 驱动读，经块缓冲读出，不要求对齐
  * 
  * @param offset 
  * @param out_content 
@@ -49,26 +49,26 @@ int newfs_calc_lvl(const char * path) {
  * @return int 
  */
 int newfs_driver_read(int offset, uint8_t *out_content, int size) {
-    int      offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_BLK_SZ());
-    int      bias           = offset - offset_aligned;
-    int      size_aligned   = NEWFS_ROUND_UP((size + bias), NEWFS_BLK_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    // lseek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // read(NEWFS_DRIVER(), cur, NEWFS_BLK_SZ());
-        ddriver_read(NEWFS_DRIVER(), cur, NEWFS_IO_SZ());                          // ddriver_read第三个参数size要等于设备IO单位的大小
-        cur          += NEWFS_IO_SZ();
-        size_aligned -= NEWFS_IO_SZ();   
+    struct newfs_buf* buf;
+    int      bias, len;
+
+    while (size > 0) {
+        bias = offset % NEWFS_BLK_SZ();
+        len  = NEWFS_BLK_SZ() - bias < size ? NEWFS_BLK_SZ() - bias : size;
+        buf  = newfs_buf_get(NEWFS_OFS_BLK(offset), TRUE);
+        if (buf == NULL) {
+            return -NEWFS_ERROR_IO;
+        }
+        memcpy(out_content, buf->data + bias, len);
+        newfs_buf_put(buf);
+        out_content += len;
+        offset      += len;
+        size        -= len;
     }
-    memcpy(out_content, temp_content + bias, size);
-    free(temp_content);
     return NEWFS_ERROR_NONE;
 }
 /**
- * @brief 驱动写
+ * @brief 驱动写，写入块缓冲并标脏，整块覆盖时不读旧内容
  * 
  * @param offset 
  * @param in_content 
@@ -76,28 +76,84 @@ int newfs_driver_read(int offset, uint8_t *out_content, int size) {
  * @return int 
  */
 int newfs_driver_write(int offset, uint8_t *in_content, int size) {
-    int      offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_BLK_SZ());
-    int      bias           = offset - offset_aligned;
-    int      size_aligned   = NEWFS_ROUND_UP((size + bias), NEWFS_BLK_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    newfs_driver_read(offset_aligned, temp_content, size_aligned);
-    memcpy(temp_content + bias, in_content, size);
-    
-    // lseek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // write(NEWFS_DRIVER(), cur, NEWFS_IO_SZ());
-        ddriver_write(NEWFS_DRIVER(), cur, NEWFS_IO_SZ());                           // ddriver_write第三个参数size要等于设备IO单位的大小
-        cur          += NEWFS_IO_SZ();
-        size_aligned -= NEWFS_IO_SZ();   
-    }
+    struct newfs_buf* buf;
+    int      bias, len;
 
-    free(temp_content);
+    while (size > 0) {
+        bias = offset % NEWFS_BLK_SZ();
+        len  = NEWFS_BLK_SZ() - bias < size ? NEWFS_BLK_SZ() - bias : size;
+        buf  = newfs_buf_get(NEWFS_OFS_BLK(offset), len < NEWFS_BLK_SZ());
+        if (buf == NULL) {
+            return -NEWFS_ERROR_IO;
+        }
+        memcpy(buf->data + bias, in_content, len);
+        newfs_buf_dirty(buf);
+        newfs_buf_put(buf);
+        in_content += len;
+        offset     += len;
+        size       -= len;
+    }
     return NEWFS_ERROR_NONE;
 }
 
+/**
+ * @brief 驱动批量IO，一次提交多个对齐的请求，由驱动并行服务，等待全部完成
+ * 
+ * 驱动的完成队列为所有线程共用，同一时刻只有一个线程收割，按req->priv把完成的请求
+ * 记到各自所属的批次上，其余线程等待。req->priv由本函数占用
+ * @param reqs 
+ * @param cnt 
+ * @return int 
+ */
+int newfs_driver_submit_wait(struct ddriver_req** reqs, int cnt) {
+    static pthread_mutex_t lock    = PTHREAD_MUTEX_INITIALIZER;
+    static pthread_cond_t  cond    = PTHREAD_COND_INITIALIZER;
+    static boolean         reaping = FALSE;
+    struct newfs_batch     batch   = { .done = 0, .err = NEWFS_ERROR_NONE };
+    struct newfs_batch*    owner;
+    struct ddriver_req*    done[NEWFS_QUEUE_DEPTH];
+    int submitted = 0, ret, i;
+
+    for (i = 0; i < cnt; i++) {
+        reqs[i]->priv = &batch;
+    }
+    pthread_mutex_lock(&lock);
+    while (batch.done < submitted || (submitted < cnt && batch.err == NEWFS_ERROR_NONE)) {
+        if (submitted < cnt && batch.err == NEWFS_ERROR_NONE) {
+            ret = ddriver_submit(NEWFS_DRIVER(), reqs + submitted, cnt - submitted);
+            if (ret < 0) {                                /* 出错后不再提交，等在途请求完成 */
+                batch.err = -NEWFS_ERROR_IO;
+                continue;
+            }
+            submitted += ret;
+        }
+        if (reaping) {                                    /* 其他线程正在收割，等它分发 */
+            pthread_cond_wait(&cond, &lock);
+            continue;
+        }
+        reaping = TRUE;
+        pthread_mutex_unlock(&lock);
+        ret = ddriver_reap(NEWFS_DRIVER(), done, 1, NEWFS_QUEUE_DEPTH);
+        pthread_mutex_lock(&lock);
+        reaping = FALSE;
+        pthread_cond_broadcast(&cond);
+        if (ret < 0) {
+            batch.err = -NEWFS_ERROR_IO;
+            break;
+        }
+        for (i = 0; i < ret; i++) {
+            owner = (struct newfs_batch*)done[i]->priv;
+            if (done[i]->res < 0) {
+                NEWFS_DBG("[%s] request at %ld failed: %d\n", __func__, 
+                          (long)done[i]->offset, done[i]->res);
+                owner->err = -NEWFS_ERROR_IO;
+            }
+            owner->done++;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return batch.err;
+}
 /**
  * @brief 为一个inode分配dentry，采用头插法
  * 
@@ -160,10 +216,7 @@ struct newfs_inode* newfs_alloc_inode(struct newfs_dentry * dentry) {
     int byte_cursor = 0; 
     int bit_cursor  = 0; 
     int ino_cursor  = 0;
-    int dno_cursor  = 0;
-    int data_cnt    = 0;
     boolean is_find_free_entry = FALSE;
-    boolean is_find_free_enough = FALSE;
     /*在inode位图上寻找未使用的inode节点*/
     for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.map_inode_blks); 
          byte_cursor++)
@@ -200,16 +253,151 @@ struct newfs_inode* newfs_alloc_inode(struct newfs_dentry * dentry) {
     inode->dir_cnt = 0;
     inode->dentrys = NULL;
     
-    // /*分配inode时不在data位图上分配节点，刷回磁盘的时候按需分配*/
-    
-    /*对于FILE类型要给其分配空间，不必分配连续的空间，分配一个指针即可，同时分配*/
-    if (NEWFS_IS_REG(inode)) {
-        for(int cnt=0;cnt<NEWFS_DATA_PER_FILE;cnt++){
-            inode->data[cnt] = (uint8_t *)malloc(NEWFS_BLK_SZ());
+    /*分配inode时不在data位图上分配数据块，写入或刷回磁盘时按需分配*/
+    inode->flags    = 0;
+    newfs_bmap_init(inode);
+    inode->blks     = 0;
+    inode->pages    = NULL;
+    inode->nr_pages = 0;
+    inode->is_dirty = FALSE;
+    pthread_mutex_init(&inode->page_lock, NULL);
+
+    return inode;
+}
+
+/**
+ * @brief 分配数据块，优先从goal起找长度为want的连续空闲段
+ * 
+ * 找不到足够长的段时退而取goal之后第一段空闲块，尽量减少文件的区段数
+ * @param goal 期望的起始数据块号，通常紧接文件末尾
+ * @param want 期望的块数
+ * @param got 实际分配的块数，不超过want
+ * @return int 起始数据块号，负数为失败
+ */
+int newfs_alloc_data(int goal, int want, int* got) {
+    int dno, cnt, start = -1, first = -1, run = 0;
+
+    if (goal < 0 || goal >= newfs_super.max_data) {
+        goal = 0;
+    }
+    for (cnt = 0; cnt < newfs_super.max_data; cnt++) {
+        dno = (goal + cnt) % newfs_super.max_data;
+        if (dno == 0) {                                   /* 回绕后的段不与之前相连 */
+            run = 0;
+        }
+        if (NEWFS_MAP_TEST(newfs_super.map_data, dno)) {
+            run = 0;
+            continue;
+        }
+        if (first < 0) {
+            first = dno;
+        }
+        if (run++ == 0) {
+            start = dno;
+        }
+        if (run == want) {
+            break;
+        }
+    }
+    if (run < want) {                                     /* 没有足够长的段 */
+        if (first < 0) {
+            return -NEWFS_ERROR_NOSPACE;
         }
+        start = first;
+        for (run = 0; run < want && start + run < newfs_super.max_data &&
+                      !NEWFS_MAP_TEST(newfs_super.map_data, start + run); run++);
     }
+    for (cnt = 0; cnt < run; cnt++) {
+        NEWFS_MAP_SET(newfs_super.map_data, start + cnt);
+    }
+    *got = run;
+    return start;
+}
 
-    return inode;
+/**
+ * @brief 按mount选项初始化新inode的映射区
+ * 
+ * @param inode 
+ */
+void newfs_bmap_init(struct newfs_inode* inode) {
+    if (newfs_super.use_extents) {
+        newfs_ext_init(inode);
+    }
+    else {
+        newfs_ind_init(inode);
+    }
+}
+
+/**
+ * @brief 逻辑块对应的数据块，按inode的映射方式查区段树或间接块
+ * 
+ * @param inode 
+ * @param lblk 
+ * @return int 数据块号，未映射返回-1
+ */
+int newfs_bmap(struct newfs_inode* inode, int lblk) {
+    if (inode->flags & NEWFS_INODE_EXTENTS) {
+        return newfs_ext_map(inode, lblk, NULL);
+    }
+    return newfs_ind_map(inode, lblk);
+}
+
+/**
+ * @brief 将inode的映射扩展到nblks块
+ * 
+ * @param inode 
+ * @param nblks 
+ * @return int 
+ */
+int newfs_bmap_grow(struct newfs_inode* inode, int nblks) {
+    if (inode->flags & NEWFS_INODE_EXTENTS) {
+        return newfs_ext_grow(inode, nblks);
+    }
+    return newfs_ind_grow(inode, nblks);
+}
+
+/**
+ * @brief 将inode的映射截断到nblks块，其后的数据块和变空的索引块释放并记入待丢弃位图
+ * 
+ * @param inode 
+ * @param nblks 
+ * @return int 
+ */
+int newfs_bmap_shrink(struct newfs_inode* inode, int nblks) {
+    if (inode->flags & NEWFS_INODE_EXTENTS) {
+        return newfs_ext_shrink(inode, nblks);
+    }
+    return newfs_ind_shrink(inode, nblks);
+}
+
+/**
+ * @brief 收集inode在逻辑块范围[from, to)内的映射，物理连续的块为一个区段
+ * 
+ * 区段可能超出范围，由调用者截取；只访问覆盖该范围的区段树节点或间接块
+ * @param inode 
+ * @param from 
+ * @param to 
+ * @param exts 返回malloc的数组，由调用者释放
+ * @return int 区段个数，负数为失败
+ */
+int newfs_bmap_collect(struct newfs_inode* inode, int from, int to, struct newfs_extent** exts) {
+    if (inode->flags & NEWFS_INODE_EXTENTS) {
+        return newfs_ext_collect(inode, from, to, exts);
+    }
+    return newfs_ind_collect(inode, from, to, exts);
+}
+
+/**
+ * @brief inode已映射的逻辑块数
+ * 
+ * @param inode 
+ * @return int 
+ */
+int newfs_bmap_blks(struct newfs_inode* inode) {
+    if (inode->flags & NEWFS_INODE_EXTENTS) {
+        return newfs_ext_blks(inode);
+    }
+    return newfs_ind_blks(inode);
 }
 
 /**
@@ -222,16 +410,23 @@ int newfs_sync_inode(struct newfs_inode * inode) {
     struct newfs_inode_d  inode_d;
     struct newfs_dentry*  dentry_cursor;
     struct newfs_dentry_d dentry_d;
-    int ino             = inode->ino;
+    int ino = inode->ino;
+    int dir_cnt, offset, dno, ret;
+
+    if (NEWFS_IS_DIR(inode)) {                        /* 目录项所需的块先映射，inode中才是最终的映射区 */
+        ret = newfs_bmap_grow(inode, (inode->dir_cnt + NEWFS_DENTRY_PER_BLK() - 1) / NEWFS_DENTRY_PER_BLK());
+        if (ret != NEWFS_ERROR_NONE) {
+            return ret;
+        }
+    }
+
+    memset(&inode_d, 0, sizeof(struct newfs_inode_d));
     inode_d.ino         = ino;
     inode_d.size        = inode->size;
     inode_d.ftype       = inode->dentry->ftype;
     inode_d.dir_cnt     = inode->dir_cnt;
-    int dno_cnt;
-    for(dno_cnt=0; dno_cnt < NEWFS_DATA_PER_FILE; dno_cnt++){
-        inode_d.dno[dno_cnt] = inode->dno[dno_cnt];
-    }
-    int offset;
+    inode_d.flags       = inode->flags;
+    memcpy(inode_d.block, inode->block, sizeof(inode_d.block));
     
     if (newfs_driver_write(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d, 
                      sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE) {
@@ -242,96 +437,59 @@ int newfs_sync_inode(struct newfs_inode * inode) {
                                                       /* Cycle 1: 写 INODE */
                                                       /* Cycle 2: 写 数据 */
     if (NEWFS_IS_DIR(inode)) {       
-        dno_cnt = 0;                   
+        dir_cnt = 0;
         dentry_cursor = inode->dentrys;
-        while (dentry_cursor != NULL && dno_cnt < NEWFS_DATA_PER_FILE){
-            offset = NEWFS_DATA_OFS(inode->dno[dno_cnt]);
-            /*逐层进行目录的写入*/
-            while (dentry_cursor != NULL)
-            {
-                memcpy(dentry_d.fname, dentry_cursor->fname, NEWFS_MAX_FILE_NAME);
-                dentry_d.ftype = dentry_cursor->ftype;
-                dentry_d.ino = dentry_cursor->ino;
-                if (newfs_driver_write(offset, (uint8_t *)&dentry_d, 
-                                    sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE) {
-                    NEWFS_DBG("[%s] io error\n", __func__);
-                    return -NEWFS_ERROR_IO;                     
-                }
-            
-                if (dentry_cursor->inode != NULL) {
-                    newfs_sync_inode(dentry_cursor->inode);
-                }
-
-                dentry_cursor = dentry_cursor->brother;
-                offset += sizeof(struct newfs_dentry_d);
-                
-                // 每次写入一个目录，为其在数据位图上分配一个节点
-                int dno_cursor = 0;
-                boolean is_find_free_enough = FALSE;
-                for (int byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.map_data_blks); 
-                    byte_cursor++)
-                {
-                    for (int bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-                        if((newfs_super.map_data[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                                /* 当前dno_cursor位置空闲 */
-                            newfs_super.map_data[byte_cursor] |= (0x1 << bit_cursor);
-                            inode->dno[dno_cnt] = dno_cursor;  /*为当前目录项分配data节点*/
-                            is_find_free_enough = TRUE;
-                            break;
-                        }
-                        dno_cursor++;
-                    }
-                    if (is_find_free_enough) {
-                        break;
-                    }
-                }
-                if (!is_find_free_enough || dno_cursor == newfs_super.max_data)
-                    return -NEWFS_ERROR_NOSPACE;
-
-                if((offset+sizeof(struct newfs_dentry_d))>NEWFS_DATA_OFS(inode->dno[dno_cnt]+1)){       /*如果一个数据块不够写，写到下一个数据块*/
-                    break;
+        while (dentry_cursor != NULL)
+        {
+            dno = newfs_bmap(inode, dir_cnt / NEWFS_DENTRY_PER_BLK());
+            if (dno < 0) {
+                NEWFS_DBG("[%s] io error\n", __func__);
+                return -NEWFS_ERROR_IO;
+            }
+            offset = NEWFS_DATA_OFS(dno) +
+                     (dir_cnt % NEWFS_DENTRY_PER_BLK()) * sizeof(struct newfs_dentry_d);
+            memset(&dentry_d, 0, sizeof(struct newfs_dentry_d));
+            memcpy(dentry_d.fname, dentry_cursor->fname, NEWFS_MAX_FILE_NAME);
+            dentry_d.ftype = dentry_cursor->ftype;
+            dentry_d.ino   = dentry_cursor->ino;
+            dentry_d.valid = TRUE;
+            if (newfs_driver_write(offset, (uint8_t *)&dentry_d, 
+                                sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE) {
+                NEWFS_DBG("[%s] io error\n", __func__);
+                return -NEWFS_ERROR_IO;                     
+            }
+            if (dentry_cursor->inode != NULL) {
+                ret = newfs_sync_inode(dentry_cursor->inode);
+                if (ret != NEWFS_ERROR_NONE) {
+                    return ret;
                 }
             }
-            dno_cnt++;
+            dentry_cursor = dentry_cursor->brother;
+            dir_cnt++;
         }
     }
 
     else if (NEWFS_IS_REG(inode)) {
-        /*inode对应文件格式的写入*/
-        for(dno_cnt=0;dno_cnt<NEWFS_DATA_PER_FILE;dno_cnt++){
-            if (newfs_driver_write(NEWFS_DATA_OFS(inode->dno[dno_cnt]), inode->data[dno_cnt], 
-                                NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
-                NEWFS_DBG("[%s] io error\n", __func__);
-                return -NEWFS_ERROR_IO;
-            }
-
-             // 每次写入一个数据块，为其在数据位图上分配一个节点
-            int dno_cursor = 0;
-            boolean is_find_free_enough = FALSE;
-            for (int byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.map_data_blks); 
-                byte_cursor++)
-            {
-                for (int bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-                    if((newfs_super.map_data[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                            /* 当前dno_cursor位置空闲 */
-                        newfs_super.map_data[byte_cursor] |= (0x1 << bit_cursor);
-                        inode->dno[dno_cnt] = dno_cursor;  /*为当前目录项分配data节点*/
-                        is_find_free_enough = TRUE;
-                        break;
-                    }
-                    dno_cursor++;
-                }
-                if (is_find_free_enough) {
-                    break;
-                }
-            }
-            if (!is_find_free_enough || dno_cursor == newfs_super.max_data)
-                return -NEWFS_ERROR_NOSPACE;
+        /*只写回页缓存中的脏页，物理连续的一段一个请求*/
+        if (newfs_page_sync(inode) != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] io error\n", __func__);
+            return -NEWFS_ERROR_IO;
         }
     }
     return NEWFS_ERROR_NONE;
 }
 
+/**
+ * @brief 释放一个数据块，清除数据位图并记入待丢弃位图
+ * 
+ * @param dno 数据块在数据位图中的下标
+ */
+void newfs_drop_data(int dno) {
+    newfs_buf_forget(NEWFS_OFS_BLK(NEWFS_DATA_OFS(dno)));
+    NEWFS_MAP_CLEAR(newfs_super.map_data, dno);
+    NEWFS_MAP_SET(newfs_super.map_discard, dno);
+}
+
 /**
  * @brief 
  * 
@@ -344,12 +502,13 @@ struct newfs_inode* newfs_read_inode(struct newfs_dentry * dentry, int ino) {
     struct newfs_inode_d inode_d;
     struct newfs_dentry* sub_dentry;
     struct newfs_dentry_d dentry_d;
-    int    dir_cnt = 0, dno_cnt = 0;
+    int    dir_cnt = 0, offset, dno, i;
 
     /*通过磁盘驱动来将磁盘中ino号的inode读入内存*/
     if (newfs_driver_read(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d, 
                         sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE) {
         NEWFS_DBG("[%s] io error\n", __func__);
+        free(inode);
         return NULL;                    
     }
     inode->dir_cnt = 0;
@@ -357,20 +516,33 @@ struct newfs_inode* newfs_read_inode(struct newfs_dentry * dentry, int ino) {
     inode->size = inode_d.size;
     inode->dentry = dentry;
     inode->dentrys = NULL;
-    for(dno_cnt=0; dno_cnt < NEWFS_DATA_PER_FILE;dno_cnt++){
-        inode->dno[dno_cnt] = inode_d.dno[dno_cnt];
+    inode->flags = inode_d.flags;
+    memcpy(inode->block, inode_d.block, sizeof(inode->block));
+    inode->blks = newfs_bmap_blks(inode);
+    inode->pages = NULL;
+    inode->nr_pages = 0;
+    inode->is_dirty = FALSE;
+    if (inode->blks < 0) {
+        NEWFS_DBG("[%s] io error\n", __func__);
+        free(inode);
+        return NULL;
     }
+    pthread_mutex_init(&inode->page_lock, NULL);
 
     /*此处实现方式类似sync_icode，分两种文件类型分别讨论*/
-    /*若是目录类型*/
+    /*若是目录类型，第i个目录项在第i/NEWFS_DENTRY_PER_BLK()个逻辑块中*/
     if (NEWFS_IS_DIR(inode)) {
         dir_cnt = inode_d.dir_cnt;
-        dno_cnt = 0;
-        int i = 0,off_cnt = 0;
-        while(i < dir_cnt && dno_cnt < NEWFS_DATA_PER_FILE)      
+        for (i = 0; i < dir_cnt; i++)
         {
-            if (newfs_driver_read(NEWFS_DATA_OFS(inode->dno[dno_cnt]) + off_cnt * sizeof(struct newfs_dentry_d), 
-                                (uint8_t *)&dentry_d, 
+            dno = newfs_bmap(inode, i / NEWFS_DENTRY_PER_BLK());
+            if (dno < 0) {
+                NEWFS_DBG("[%s] io error\n", __func__);
+                return NULL;
+            }
+            offset = NEWFS_DATA_OFS(dno) +
+                     (i % NEWFS_DENTRY_PER_BLK()) * sizeof(struct newfs_dentry_d);
+            if (newfs_driver_read(offset, (uint8_t *)&dentry_d, 
                                 sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE) {
                 NEWFS_DBG("[%s] io error\n", __func__);
                 return NULL;                    
@@ -379,27 +551,9 @@ struct newfs_inode* newfs_read_inode(struct newfs_dentry * dentry, int ino) {
             sub_dentry->parent = inode->dentry;
             sub_dentry->ino    = dentry_d.ino; 
             newfs_alloc_dentry(inode, sub_dentry);
-            i++;
-            off_cnt++;
-            /*如果一个数据块不够写，写到下一个数据块*/
-            if(NEWFS_DATA_OFS(inode->dno[dno_cnt]) + (off_cnt+1) * sizeof(struct newfs_dentry_d) > NEWFS_DATA_OFS(inode->dno[dno_cnt]+1)){  
-                dno_cnt++;
-                off_cnt = 0;
-            }
-        }
-    }
-    /*若是文件类型直接读取数据即可*/
-    else if (NEWFS_IS_REG(inode)) {
-        /*对于文件的每一个数据块分别进行读取*/
-        for(dno_cnt = 0;dno_cnt < NEWFS_DATA_PER_FILE;dno_cnt++){
-            inode->data[dno_cnt] = (uint8_t *)malloc(NEWFS_BLK_SZ());
-            if (newfs_driver_read(NEWFS_DATA_OFS(inode->dno[dno_cnt]), (uint8_t *)inode->data[dno_cnt], 
-                                NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
-                NEWFS_DBG("[%s] io error\n", __func__);
-                return NULL;                    
-            }
         }
     }
+    /*若是文件类型，内容在读写时经页缓存按需载入，查找路径和getattr不读文件内容*/
     return inode;
 }
 
@@ -448,7 +602,7 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
     int   lvl = 0;
     boolean is_hit;
     char* fname = NULL;
-    char* path_cpy = (char*)malloc(sizeof(path));
+    char* path_cpy = (char*)malloc(strlen(path) + 1);
     *is_root = FALSE;
     strcpy(path_cpy, path);                         /*分析路径函数*/
 
@@ -462,7 +616,7 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
     {   
         lvl++;
         if (dentry_cursor->inode == NULL) {           /* Cache机制 */
-            newfs_read_inode(dentry_cursor, dentry_cursor->ino);
+            dentry_cursor->inode = newfs_read_inode(dentry_cursor, dentry_cursor->ino);
         }
 
         inode = dentry_cursor->inode;
@@ -479,7 +633,7 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
 
             while (dentry_cursor)
             {
-                if (memcmp(dentry_cursor->fname, fname, strlen(fname)) == 0) {
+                if (strcmp(dentry_cursor->fname, fname) == 0) {
                     is_hit = TRUE;
                     break;
                 }
@@ -505,7 +659,7 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
     if (dentry_ret->inode == NULL) {
         dentry_ret->inode = newfs_read_inode(dentry_ret, dentry_ret->ino);
     }
-    
+    free(path_cpy);
     return dentry_ret;
 }
 
@@ -513,11 +667,11 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
  * @brief 挂载newfs, Layout 如下
  * 
  * Layout
- * | Super | Inode Map | Data |
+ * | Super | Inode Map | Data Map | Inode | Data |
  * 
- * BLK_SZ = 2*Inode_SZ
+ * BLK_SZ = 2*IO_SZ
  * 
- * 每个Inode占用一个Blk
+ * 每块存放NEWFS_INODE_PER_BLK()个Inode，数据区占满剩余空间，上限为数据位图的位数
  * @param options 
  * @return int 
  */
@@ -530,6 +684,7 @@ int newfs_mount(struct custom_options options){
     struct newfs_inode*   root_inode;
 
     int                 inode_num;
+    int                 inode_blks;
     int                 data_num;
     int                 map_inode_blks;
     int                 map_data_blks;
@@ -539,6 +694,17 @@ int newfs_mount(struct custom_options options){
 
     newfs_super.is_mounted = FALSE;
 
+    if (options.mapping == NULL || strcmp(options.mapping, "extent") == 0) {   /* 新建inode的映射方式 */
+        newfs_super.use_extents = TRUE;
+    }
+    else if (strcmp(options.mapping, "indirect") == 0) {
+        newfs_super.use_extents = FALSE;
+    }
+    else {
+        NEWFS_DBG("[%s] unknown mapping %s\n", __func__, options.mapping);
+        return -NEWFS_ERROR_INVAL;
+    }
+
     // driver_fd = open(options.device, O_RDWR);
     driver_fd = ddriver_open(options.device);   /*打开驱动*/
 
@@ -548,10 +714,18 @@ int newfs_mount(struct custom_options options){
 
     /* 向内存超级块中标记驱动并写入磁盘大小和单次IO大小*/
     newfs_super.driver_fd = driver_fd;
+    if (ddriver_queue_init(driver_fd, NEWFS_QUEUE_DEPTH) < 0) {   /*建立异步请求队列*/
+        ddriver_close(driver_fd);
+        return -NEWFS_ERROR_IO;
+    }
     ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_SIZE,  &newfs_super.sz_disk);
     ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &newfs_super.sz_io);
 
     newfs_super.sz_blk = 2*newfs_super.sz_io;   //io的大小为512B，文件系统一个块位1024B
+    if (newfs_buf_init() != NEWFS_ERROR_NONE) {   /*块缓冲，元数据与数据的读写都经过它*/
+        ddriver_close(driver_fd);
+        return -NEWFS_ERROR_NOSPACE;
+    }
     /*创建根目录项并读取磁盘超级块到内存*/
     root_dentry = new_dentry("/", NEWFS_DIR);
 
@@ -566,10 +740,15 @@ int newfs_mount(struct custom_options options){
 
         /* 为了简单起见，我们可以自行 规定位图 的大小 */
         super_blks = NEWFS_SUPER_BLKS;
-        inode_num  =  NEWFS_INODE_BLKS;
-        data_num = NEWFS_DATA_BLKS;
+        inode_num  =  NEWFS_MAX_INO;
+        inode_blks = (inode_num * NEWFS_INODE_SZ + NEWFS_BLK_SZ() - 1) / NEWFS_BLK_SZ();
         map_inode_blks = NEWFS_MAP_INODE_BLKS;
         map_data_blks = NEWFS_MAP_DATA_BLKS;
+        data_num = NEWFS_DISK_SZ() / NEWFS_BLK_SZ() - 
+                   (super_blks + map_inode_blks + map_data_blks + inode_blks);   /* 其余的块都是数据块 */
+        if (data_num > NEWFS_BLKS_SZ(map_data_blks) * UINT8_BITS) {
+            data_num = NEWFS_BLKS_SZ(map_data_blks) * UINT8_BITS;
+        }
         
                                                       /* 布局layout */
         newfs_super.max_ino = inode_num; 
@@ -578,12 +757,15 @@ int newfs_mount(struct custom_options options){
         newfs_super_d.map_inode_offset = NEWFS_SUPER_OFS + NEWFS_BLKS_SZ(super_blks);
         newfs_super_d.map_data_offset = newfs_super_d.map_inode_offset + NEWFS_BLKS_SZ(map_inode_blks);
         newfs_super_d.inode_offset = newfs_super_d.map_data_offset + NEWFS_BLKS_SZ(map_data_blks);
-        newfs_super_d.data_offset = newfs_super_d.inode_offset + NEWFS_BLKS_SZ(inode_num);
+        newfs_super_d.data_offset = newfs_super_d.inode_offset + NEWFS_BLKS_SZ(inode_blks);
 
         newfs_super_d.map_inode_blks  = map_inode_blks;
         newfs_super_d.map_data_blks  = map_data_blks;
         
         newfs_super_d.magic_num    = NEWFS_MAGIC_NUM;
+        newfs_super_d.version      = NEWFS_VERSION;
+        newfs_super_d.max_ino      = inode_num;
+        newfs_super_d.max_data     = data_num;
         newfs_super_d.sz_usage    = 0;
         NEWFS_DBG("inode map blocks: %d\n", map_inode_blks);
         NEWFS_DBG("data map blocks: %d\n", map_data_blks);
@@ -595,6 +777,7 @@ int newfs_mount(struct custom_options options){
     
     newfs_super.map_inode = (uint8_t *)malloc(NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks));
     newfs_super.map_data = (uint8_t *)malloc(NEWFS_BLKS_SZ(newfs_super_d.map_data_blks));
+    newfs_super.map_discard = (uint8_t *)calloc(1, NEWFS_BLKS_SZ(newfs_super_d.map_data_blks));
     newfs_super.map_inode_blks = newfs_super_d.map_inode_blks;
     newfs_super.map_data_blks = newfs_super_d.map_data_blks;
     newfs_super.map_inode_offset = newfs_super_d.map_inode_offset;
@@ -612,6 +795,14 @@ int newfs_mount(struct custom_options options){
         return -NEWFS_ERROR_IO;
     }
 
+    if (!is_init && newfs_super_d.version < NEWFS_VERSION) {   /* 旧版本镜像原地升级 */
+        if (newfs_upgrade(&newfs_super_d) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    newfs_super.max_ino = newfs_super_d.max_ino;
+    newfs_super.max_data = newfs_super_d.max_data;
+
     if (is_init) {                                    /* 分配根节点 */
         root_inode = newfs_alloc_inode(root_dentry);
         newfs_sync_inode(root_inode);                 /*将根节点写回磁盘*/
@@ -625,6 +816,139 @@ int newfs_mount(struct custom_options options){
     return ret;
 }
 
+/**
+ * @brief 将版本1、2的镜像原地升级为版本3
+ * 
+ * 旧inode中的直接块dno[]按mount选项转成区段树的根或ext2式的直接块，至多NEWFS_DATA_PER_FILE块，
+ * 都放得进inode内的映射区，不需要分配节点块或间接块。
+ * 数据区改从旧数据位图处开始，延伸到磁盘末尾，旧数据位图和旧inode表所在的块并入数据区，
+ * 旧数据块原地不动，只是dno整体后移。新inode表和新数据位图放在旧数据区(NEWFS_DATA_BLKS块)之后
+ * 原本未用的块中，在新位图中标为已用。二者写完并落盘后才更新超级块，中途掉电镜像仍是完整的旧版本。
+ * 并入数据区的旧元数据块交给设备丢弃
+ * @param super_d 已读入的超级块，升级后更新
+ * @return int 
+ */
+int newfs_upgrade(struct newfs_super_d* super_d) {
+    struct newfs_inode_d_v2 inode_v2;
+    struct newfs_inode_d*   inode_d;
+    struct newfs_inode      inode;
+    struct ddriver_range    range;
+    uint8_t*                inodes;
+    uint8_t*                map_data;
+    int ino, max_ino, stride, new_blks, nblks, dno, i;
+    int area_blk, old_data_blk, tail_blk, shift, max_data, map_sz;
+
+    max_ino      = super_d->version < 2 ? NEWFS_INODE_BLKS_V1 : super_d->max_ino;
+    stride       = super_d->version < 2 ? NEWFS_BLK_SZ() : NEWFS_INODE_SZ_V2;
+    new_blks     = (max_ino * NEWFS_INODE_SZ + NEWFS_BLK_SZ() - 1) / NEWFS_BLK_SZ();
+    map_sz       = NEWFS_BLKS_SZ(super_d->map_data_blks);
+    area_blk     = NEWFS_OFS_BLK(super_d->map_data_offset);   /* 新数据区的第0块 */
+    old_data_blk = NEWFS_OFS_BLK(super_d->data_offset);
+    shift        = old_data_blk - area_blk;
+    tail_blk     = old_data_blk + NEWFS_DATA_BLKS;            /* 新inode表，其后为新数据位图 */
+    max_data     = NEWFS_DISK_SZ() / NEWFS_BLK_SZ() - area_blk;
+    if (max_data > map_sz * UINT8_BITS) {
+        max_data = map_sz * UINT8_BITS;
+    }
+    if (tail_blk + new_blks + super_d->map_data_blks - area_blk > max_data) {
+        NEWFS_DBG("[%s] no room for the inode table\n", __func__);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+
+    inodes   = (uint8_t *)calloc(max_ino, NEWFS_INODE_SZ);
+    map_data = (uint8_t *)calloc(1, map_sz);
+    if (inodes == NULL || map_data == NULL) {
+        free(inodes);
+        free(map_data);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (dno = 0; dno < NEWFS_DATA_BLKS; dno++) {
+        if (NEWFS_MAP_TEST(newfs_super.map_data, dno)) {
+            NEWFS_MAP_SET(map_data, dno + shift);
+        }
+    }
+    for (i = tail_blk; i < tail_blk + new_blks + super_d->map_data_blks; i++) {
+        NEWFS_MAP_SET(map_data, i - area_blk);
+    }
+    for (ino = 0; ino < max_ino; ino++) {
+        if (!NEWFS_MAP_TEST(newfs_super.map_inode, ino)) {
+            continue;
+        }
+        if (newfs_driver_read(newfs_super.inode_offset + ino * stride, (uint8_t *)&inode_v2,
+                              sizeof(struct newfs_inode_d_v2)) != NEWFS_ERROR_NONE) {
+            free(inodes);
+            free(map_data);
+            return -NEWFS_ERROR_IO;
+        }
+        if (inode_v2.ftype == NEWFS_DIR) {
+            nblks = (inode_v2.dir_cnt + NEWFS_DENTRY_PER_BLK() - 1) / NEWFS_DENTRY_PER_BLK();
+        }
+        else {
+            nblks = (inode_v2.size + NEWFS_BLK_SZ() - 1) / NEWFS_BLK_SZ();
+        }
+        if (nblks > NEWFS_DATA_PER_FILE) {
+            nblks = NEWFS_DATA_PER_FILE;
+        }
+        inode.flags = 0;
+        newfs_bmap_init(&inode);
+        for (i = 0; i < nblks; i++) {                 /* 根节点或直接块放得下，不会分配数据块 */
+            dno = inode_v2.dno[i] + shift;
+            if (inode.flags & NEWFS_INODE_EXTENTS) {
+                newfs_ext_append(&inode, i, dno, 1);
+            }
+            else {
+                inode.block[i] = area_blk + dno;      /* 设备块号，与数据区起点无关 */
+            }
+        }
+        inode_d = (struct newfs_inode_d *)(inodes + ino * NEWFS_INODE_SZ);
+        inode_d->ino     = inode_v2.ino;
+        inode_d->size    = inode_v2.size;
+        inode_d->dir_cnt = inode_v2.dir_cnt;
+        inode_d->ftype   = inode_v2.ftype;
+        inode_d->flags   = inode.flags;
+        memcpy(inode_d->block, inode.block, sizeof(inode_d->block));
+    }
+    if (newfs_driver_write(NEWFS_BLKS_SZ(tail_blk), inodes,          /* 整块写入，不读旧内容 */
+                           NEWFS_BLKS_SZ(new_blks)) != NEWFS_ERROR_NONE ||
+        newfs_driver_write(NEWFS_BLKS_SZ(tail_blk + new_blks), map_data,
+                           map_sz) != NEWFS_ERROR_NONE ||
+        newfs_buf_sync() != NEWFS_ERROR_NONE) {
+        free(inodes);
+        free(map_data);
+        return -NEWFS_ERROR_IO;
+    }
+    free(inodes);
+
+    range.offset = NEWFS_BLKS_SZ(area_blk);
+    range.size   = NEWFS_BLKS_SZ(shift);
+    super_d->map_data_offset = NEWFS_BLKS_SZ(tail_blk + new_blks);
+    super_d->inode_offset    = NEWFS_BLKS_SZ(tail_blk);
+    super_d->data_offset     = NEWFS_BLKS_SZ(area_blk);
+    super_d->max_ino         = max_ino;
+    super_d->max_data        = max_data;
+    super_d->version         = NEWFS_VERSION;
+    if (newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t *)super_d,
+                           sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE ||
+        newfs_buf_sync() != NEWFS_ERROR_NONE) {
+        free(map_data);
+        return -NEWFS_ERROR_IO;
+    }
+    free(newfs_super.map_data);
+    newfs_super.map_data         = map_data;
+    newfs_super.map_data_offset  = super_d->map_data_offset;
+    newfs_super.inode_offset     = super_d->inode_offset;
+    newfs_super.data_offset      = super_d->data_offset;
+    for (i = 0; i < shift; i++) {
+        newfs_buf_forget(area_blk + i);
+    }
+    if (ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_DISCARD, &range) < 0) {
+        NEWFS_DBG("[%s] discard error\n", __func__);
+    }
+    NEWFS_DBG("upgraded to version %d, inode table at %d, %d data blocks\n",
+              NEWFS_VERSION, super_d->inode_offset, max_data);
+    return NEWFS_ERROR_NONE;
+}
+
 /**
  * @brief 
  * 
@@ -641,6 +965,9 @@ int newfs_umount() {
 
     /*将内存超级块转换为磁盘超级块并写入磁盘*/                                                
     newfs_super_d.magic_num           = NEWFS_MAGIC_NUM;
+    newfs_super_d.version             = NEWFS_VERSION;
+    newfs_super_d.max_ino             = newfs_super.max_ino;
+    newfs_super_d.max_data            = newfs_super.max_data;
     newfs_super_d.map_inode_blks      = newfs_super.map_inode_blks;
     newfs_super_d.map_data_blks       = newfs_super.map_data_blks;
     newfs_super_d.map_inode_offset    = newfs_super.map_inode_offset;
@@ -665,11 +992,52 @@ int newfs_umount() {
         return -NEWFS_ERROR_IO;
     }
 
+    if (newfs_buf_sync() != NEWFS_ERROR_NONE) {       /* 脏缓冲写回，须在丢弃之前 */
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_discard_sync();                             /* 释放的数据块交给设备丢弃 */
+    newfs_buf_destroy();
+
     free(newfs_super.map_inode);
     free(newfs_super.map_data);
+    free(newfs_super.map_discard);
 
     /*关闭驱动*/
     ddriver_close(NEWFS_DRIVER());
 
     return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将已释放的数据块批量丢弃，相邻的合并为一次IOC_REQ_DEVICE_DISCARD
+ * 
+ * 释放后又被重新分配的块仍在数据位图中占用，不会被丢弃
+ * @return int 
+ */
+int newfs_discard_sync() {
+    struct ddriver_range range;
+    int dno, start = -1;
+    int ret = NEWFS_ERROR_NONE;
+
+    for (dno = 0; dno <= newfs_super.max_data; dno++) {
+        if (dno < newfs_super.max_data &&
+            NEWFS_MAP_TEST(newfs_super.map_discard, dno) &&
+            !NEWFS_MAP_TEST(newfs_super.map_data, dno)) {
+            if (start < 0) {
+                start = dno;
+            }
+            continue;
+        }
+        if (start >= 0) {
+            range.offset = NEWFS_DATA_OFS(start);
+            range.size   = NEWFS_DATA_OFS(dno) - NEWFS_DATA_OFS(start);
+            if (ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_DISCARD, &range) < 0) {
+                NEWFS_DBG("[%s] discard error\n", __func__);
+                ret = -NEWFS_ERROR_IO;
+            }
+            start = -1;
+        }
+    }
+    memset(newfs_super.map_discard, 0, NEWFS_BLKS_SZ(newfs_super.map_data_blks));
+    return ret;
 }
\ No newline at end of file
@@ -3,10 +3,12 @@ POINTS=0
 TOTAL_POINTS=0
 TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh)
 # mount.sh mkdir.sh touch.sh ls.sh remount.sh (read.sh write.sh cp.sh)
-ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
-ALL_TEST_SCORES=(1 4 5 4 16 2 2)
+ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh bigfile.sh indirect.sh upgrade.sh lazy.sh truncate.sh)
+ALL_TEST_SCORES=(1 4 5 4 16 2 2 2 2 3 2 4)
 MNTPOINT='./mnt'
 PROJECT_NAME="newfs"
+# 虚拟设备时钟: 不真实等待，设备时间记录在 ~/ddriver_log
+export DDRIVER_CLOCK=${DDRIVER_CLOCK:-virtual}
 
 LEVEL=$1
 
@@ -35,6 +37,10 @@ elif [[ "${LEVEL}" == "6" ]]; then
     echo "开始mount, mkdir, touch, ls, read&write, cp, umount测试"
     TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
     sleep 1
+elif [[ "${LEVEL}" == "7" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, 大文件, 间接块, 镜像升级, 按需加载, 截断测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh bigfile.sh indirect.sh upgrade.sh lazy.sh truncate.sh)
+    sleep 1
 else
     echo "未知测试参数"
     exit 1
@@ -95,8 +101,10 @@ function fail() {
 }
 
 # Utils
+# MOUNT_OPTS: 额外的挂载选项，如--mapping=indirect
 function mount_fuse() {
-    "$ROOT_PATH"/../build/"${PROJECT_NAME}" --device="$HOME"/ddriver "${MNTPOINT}"
+    # shellcheck disable=SC2086
+    "$ROOT_PATH"/../build/"${PROJECT_NAME}" --device="$HOME"/ddriver ${MOUNT_OPTS} "${MNTPOINT}"
 }
 
 function check_mount() {
@@ -128,6 +136,50 @@ function clean_mount() {
     done
 }
 
+# 卸载并等待文件系统关闭设备，输出这次挂载期间设备的读次数(IOC_REQ_DEVICE_STATE的read_cnt)
+function umount_and_wait_device() {
+    sleep 1
+    umount "${MNTPOINT}"
+    for _ in $(seq 50); do
+        if grep -q "device state" "$HOME"/ddriver_log 2>/dev/null; then
+            grep "device state" "$HOME"/ddriver_log | awk '{print $6}'
+            return 0
+        fi
+        sleep 0.1
+    done
+    return 1
+}
+
+# 大文件: 写入后与原文件比较，重新挂载后再比较一次
+function check_big_write() {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ! cp "$_PARAM" "${MNTPOINT}"/big; then
+        fail "$_TEST_CASE: 写入文件${MNTPOINT}/big失败"
+        return 1
+    fi
+    if ! cmp -s "$_PARAM" "${MNTPOINT}"/big; then
+        fail "$_TEST_CASE: 写入文件${MNTPOINT}/big成功, 但读出的内容不同"
+        return 1
+    fi
+    return 0
+}
+
+function check_big_remount() {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ! umount_and_wait_device >/dev/null; then
+        fail "$_TEST_CASE: 卸载${MNTPOINT}后设备没有关闭"
+        return 1
+    fi
+    try_mount_or_fail
+    if ! cmp -s "$_PARAM" "${MNTPOINT}"/big; then
+        fail "$_TEST_CASE: 重新挂载后文件${MNTPOINT}/big的内容不同"
+        return 1
+    fi
+    return 0
+}
+
 function mkdir_and_check () {
     DIR=$1
     if [ ! -d "$DIR" ]; then
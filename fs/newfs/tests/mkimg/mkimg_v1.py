@@ -0,0 +1,92 @@
+import argparse
+import os
+import struct
+
+""" 版本1镜像布局: 块大小1024B，每个inode独占一块，每个文件至多4个直接块 """
+BLK_SZ = 1024
+DISK_SZ = 4 * 1024 * 1024
+MAGIC_NUM = 0x2001113
+MAX_INO = 512
+DATA_PER_FILE = 4
+MAX_FILE_NAME = 128
+
+MAP_INODE_OFS = BLK_SZ
+MAP_DATA_OFS = MAP_INODE_OFS + BLK_SZ
+INODE_OFS = MAP_DATA_OFS + BLK_SZ
+DATA_OFS = INODE_OFS + MAX_INO * BLK_SZ
+
+REG_FILE = 0
+DIR = 1
+
+""" 镜像内容: 路径 -> 文件内容，目录为None """
+GOLDEN = "Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum."
+TREE = [
+    ("/dir0", None),
+    ("/file0", GOLDEN + "\n"),
+    ("/dir0/file1", (GOLDEN + "\n") * 8),
+    ("/dir0/dir1", None),
+    ("/dir0/dir1/file2", ""),
+]
+
+parser = argparse.ArgumentParser()
+parser.add_argument("-o", "--output", help="path of the image",
+                    default=os.environ['HOME'] + "/ddriver")
+args = parser.parse_args()
+
+img = bytearray(DISK_SZ)
+next_ino = 0
+next_dno = 0
+
+
+def map_set(ofs: int, i: int):
+    img[ofs + i // 8] |= 1 << (i % 8)
+
+
+def alloc_blocks(data: bytes):
+    global next_dno
+    dnos = []
+    for i in range(0, len(data), BLK_SZ):
+        chunk = data[i:i + BLK_SZ]
+        img[DATA_OFS + next_dno * BLK_SZ:DATA_OFS + next_dno * BLK_SZ + len(chunk)] = chunk
+        map_set(MAP_DATA_OFS, next_dno)
+        dnos.append(next_dno)
+        next_dno += 1
+    assert len(dnos) <= DATA_PER_FILE
+    return dnos
+
+
+def write_inode(ino: int, size: int, dir_cnt: int, ftype: int, dnos):
+    dnos = dnos + [0] * (DATA_PER_FILE - len(dnos))
+    struct.pack_into("<Iiii4i", img, INODE_OFS + ino * BLK_SZ, ino, size, dir_cnt, ftype, *dnos)
+    map_set(MAP_INODE_OFS, ino)
+
+
+def dentry(name: str, ftype: int, ino: int):
+    return struct.pack("<%dsiIi" % MAX_FILE_NAME, name.encode(), ftype, ino, 1)
+
+
+def build(path: str):
+    """ 先序分配inode，目录项按TREE中的顺序排列 """
+    global next_ino
+    ino = next_ino
+    next_ino += 1
+    content = dict(TREE).get(path, None) if path != "/" else None
+    if content is not None:
+        data = content.encode()
+        write_inode(ino, len(data), 0, REG_FILE, alloc_blocks(data))
+        return ino, REG_FILE
+    prefix = path.rstrip("/") + "/"
+    children = [p for p, _ in TREE if p.startswith(prefix) and "/" not in p[len(prefix):]]
+    dentrys = b""
+    for child in children:
+        child_ino, ftype = build(child)
+        dentrys += dentry(child[len(prefix):], ftype, child_ino)
+    write_inode(ino, 0, len(children), DIR, alloc_blocks(dentrys))
+    return ino, DIR
+
+
+build("/")
+struct.pack_into("<I8i", img, 0, MAGIC_NUM, 0, 0, 1, MAP_INODE_OFS, 1, MAP_DATA_OFS,
+                 INODE_OFS, DATA_OFS)                  # 版本字段留0
+with open(args.output, "wb") as f:
+    f.write(img)
@@ -0,0 +1,19 @@
+#!/bin/bash
+
+TEST_CASE="case 8 - big file"
+
+BIG_GOLDEN=$(mktemp)
+head -c $((3 * 1024 * 1024)) /dev/urandom > "$BIG_GOLDEN"
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+TEST_CASE="case 8.1 - write 3MiB to ${MNTPOINT}/big"
+core_tester echo "$BIG_GOLDEN" check_big_write "$TEST_CASE"
+
+TEST_CASE="case 8.2 - remount and read ${MNTPOINT}/big"
+core_tester echo "$BIG_GOLDEN" check_big_remount "$TEST_CASE"
+
+rm -f "$BIG_GOLDEN"
@@ -0,0 +1,23 @@
+#!/bin/bash
+
+TEST_CASE="case 9 - indirect mapping"
+
+# 新建的文件使用ext2式的直接块与一、二、三级间接块
+MOUNT_OPTS="--mapping=indirect"
+BIG_GOLDEN=$(mktemp)
+head -c $((3 * 1024 * 1024)) /dev/urandom > "$BIG_GOLDEN"
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+TEST_CASE="case 9.1 - write 3MiB to ${MNTPOINT}/big with ${MOUNT_OPTS}"
+core_tester echo "$BIG_GOLDEN" check_big_write "$TEST_CASE"
+
+TEST_CASE="case 9.2 - remount and read ${MNTPOINT}/big"
+core_tester echo "$BIG_GOLDEN" check_big_remount "$TEST_CASE"
+
+clean_mount
+rm -f "$BIG_GOLDEN"
+unset MOUNT_OPTS
@@ -0,0 +1,45 @@
+#!/bin/bash
+
+TEST_CASE="case 11 - lazy load"
+
+# 只做getattr的一次挂载只应读元数据，3MiB的文件有3072个数据块
+MAX_META_READS=16
+
+function check_stat_reads () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    try_mount_or_fail
+    stat "${MNTPOINT}"/big > /dev/null
+    STAT_READS=$(umount_and_wait_device)
+    if [[ -z "${STAT_READS}" ]] || (( STAT_READS > MAX_META_READS )); then
+        fail "$_TEST_CASE: 只stat文件${MNTPOINT}/big, 设备读了${STAT_READS}次, 应不超过${MAX_META_READS}次"
+        return 1
+    fi
+    return 0
+}
+
+function check_cat_reads () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    try_mount_or_fail
+    cat "${MNTPOINT}"/big > /dev/null
+    CAT_READS=$(umount_and_wait_device)
+    if [[ -z "${CAT_READS}" ]] || (( CAT_READS <= STAT_READS )); then
+        fail "$_TEST_CASE: 读取文件${MNTPOINT}/big, 设备读了${CAT_READS}次, 应多于只stat时的${STAT_READS}次"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+head -c $((3 * 1024 * 1024)) /dev/urandom > "${MNTPOINT}"/big
+umount_and_wait_device > /dev/null
+
+TEST_CASE="case 11.1 - stat ${MNTPOINT}/big reads metadata only"
+core_tester ls "${MNTPOINT}" check_stat_reads "$TEST_CASE"
+
+TEST_CASE="case 11.2 - cat ${MNTPOINT}/big reads the data"
+core_tester ls "${MNTPOINT}" check_cat_reads "$TEST_CASE"
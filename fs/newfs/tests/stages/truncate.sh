@@ -0,0 +1,62 @@
+#!/bin/bash
+
+TEST_CASE="case 12 - truncate"
+
+# 截断释放的块应能再分配：3MiB截到512KiB后，磁盘上还放得下另一个2.5MiB的文件
+BIG_GOLDEN=$(mktemp)
+BIG2_GOLDEN=$(mktemp)
+head -c $((3 * 1024 * 1024)) /dev/urandom > "$BIG_GOLDEN"
+head -c $((5 * 512 * 1024)) /dev/urandom > "$BIG2_GOLDEN"
+
+function check_truncate () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ! truncate -s $((512 * 1024)) "${MNTPOINT}"/big; then
+        fail "$_TEST_CASE: 截断文件${MNTPOINT}/big失败"
+        return 1
+    fi
+    if ! cmp -s -n $((512 * 1024)) "$BIG_GOLDEN" "${MNTPOINT}"/big; then
+        fail "$_TEST_CASE: 截断后文件${MNTPOINT}/big保留的内容不同"
+        return 1
+    fi
+    if ! cp "$BIG2_GOLDEN" "${MNTPOINT}"/big2 || ! cmp -s "$BIG2_GOLDEN" "${MNTPOINT}"/big2; then
+        fail "$_TEST_CASE: 截断释放的块没有回收, 写入文件${MNTPOINT}/big2失败"
+        return 1
+    fi
+    return 0
+}
+
+function check_truncate_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ! umount_and_wait_device >/dev/null; then
+        fail "$_TEST_CASE: 卸载${MNTPOINT}后设备没有关闭"
+        return 1
+    fi
+    try_mount_or_fail
+    if [[ $(stat -c %s "${MNTPOINT}"/big) != $((512 * 1024)) ]] ||
+       ! cmp -s -n $((512 * 1024)) "$BIG_GOLDEN" "${MNTPOINT}"/big ||
+       ! cmp -s "$BIG2_GOLDEN" "${MNTPOINT}"/big2; then
+        fail "$_TEST_CASE: 重新挂载后文件${MNTPOINT}/big或${MNTPOINT}/big2的内容不同"
+        return 1
+    fi
+    return 0
+}
+
+for MOUNT_OPTS in "" "--mapping=indirect"; do
+    clean_mount
+    clean_ddriver
+
+    try_mount_or_fail
+    cp "$BIG_GOLDEN" "${MNTPOINT}"/big
+
+    TEST_CASE="case 12.1 - truncate ${MNTPOINT}/big and reuse its blocks ${MOUNT_OPTS}"
+    core_tester ls "${MNTPOINT}" check_truncate "$TEST_CASE"
+
+    TEST_CASE="case 12.2 - remount and read ${MNTPOINT}/big and ${MNTPOINT}/big2 ${MOUNT_OPTS}"
+    core_tester ls "${MNTPOINT}" check_truncate_remount "$TEST_CASE"
+done
+
+clean_mount
+rm -f "$BIG_GOLDEN" "$BIG2_GOLDEN"
+unset MOUNT_OPTS
@@ -0,0 +1,62 @@
+#!/bin/bash
+
+TEST_CASE="case 10 - upgrade"
+
+GOLDEN="Lorem ipsum dolor sit amet, consectetur adipisicing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum."
+NEWFS_VERSION=3
+VERSION_OFS=36                                      # newfs_super_d.version
+
+# mkimg_v1.py生成的目录树:
+# /: dir0 file0
+# /dir0: dir1 file1
+# /dir0/dir1: file2
+function check_tree () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    for path in dir0 file0 dir0/dir1 dir0/file1 dir0/dir1/file2; do
+        if ! stat "${MNTPOINT}/$path" > /dev/null 2>&1; then
+            fail "$_TEST_CASE: 升级后找不到${MNTPOINT}/$path"
+            return 1
+        fi
+    done
+    if [[ "$(cat "${MNTPOINT}"/file0)" != "${GOLDEN}" ]]; then
+        fail "$_TEST_CASE: 升级后文件${MNTPOINT}/file0的内容不同, 正确的内容为: $GOLDEN"
+        return 1
+    fi
+    if [[ "$(sort -u "${MNTPOINT}"/dir0/file1)" != "${GOLDEN}" ]] || 
+       [[ "$(wc -l < "${MNTPOINT}"/dir0/file1)" != "8" ]]; then
+        fail "$_TEST_CASE: 升级后文件${MNTPOINT}/dir0/file1的内容不同, 应为8行: $GOLDEN"
+        return 1
+    fi
+    return 0
+}
+
+function check_version () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ! umount_and_wait_device >/dev/null; then
+        fail "$_TEST_CASE: 卸载${MNTPOINT}后设备没有关闭"
+        return 1
+    fi
+    VERSION=$(od -An -tu4 -j $VERSION_OFS -N4 "$HOME"/ddriver | tr -d ' ')
+    if [[ "${VERSION}" != "${NEWFS_VERSION}" ]]; then
+        fail "$_TEST_CASE: 超级块中的版本为${VERSION}, 应为${NEWFS_VERSION}"
+        return 1
+    fi
+    try_mount_or_fail
+    return 0
+}
+
+clean_mount
+python3 "$ROOT_PATH"/mkimg/mkimg_v1.py -o "$HOME"/ddriver
+
+try_mount_or_fail
+
+TEST_CASE="case 10.1 - mount a version 1 image"
+core_tester ls "${MNTPOINT}" check_tree "$TEST_CASE"
+
+TEST_CASE="case 10.2 - superblock version after umount"
+core_tester ls "${MNTPOINT}" check_version "$TEST_CASE"
+
+TEST_CASE="case 10.3 - remount the upgraded image"
+core_tester ls "${MNTPOINT}" check_tree "$TEST_CASE"
@@ -3,11 +3,22 @@
 
 #include "ddriver_ctl_user.h"
 #include "stdio.h"
+#include <sys/uio.h>
 
 int ddriver_open(char *path);
+int ddriver_open_ex(char *path, struct ddriver_config *cfg);
+int ddriver_open_stripe(char **paths, int nr, int stripe_unit, struct ddriver_config *cfg);
 int ddriver_seek(int fd, off_t offset, int whence);
 int ddriver_write(int fd, char *buf, size_t size);
 int ddriver_read(int fd, char *buf, size_t size);
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt);
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt);
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+int ddriver_queue_init(int fd, int depth);
+int ddriver_queue_exit(int fd);
+int ddriver_submit(int fd, struct ddriver_req **reqs, int nr);
+int ddriver_reap(int fd, struct ddriver_req **reqs, int min_nr, int max_nr);
 int ddriver_ioctl(int fd, unsigned long cmd, void *ret);
 int ddriver_close(int fd);
 
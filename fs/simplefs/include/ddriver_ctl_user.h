@@ -2,20 +2,167 @@
 #define _DDRIVER_CTL_H_
 
 #include <sys/ioctl.h>   
+#include <sys/types.h>
 /******************************************************************************
 * SECTION: IO ctl protocol definitions
 *******************************************************************************/
 #define IOC_MAGIC               'A'
 struct ddriver_state
 {
-    int write_cnt;
-    int read_cnt;
-    int seek_cnt;
+    long long write_cnt;
+    long long read_cnt;
+    long long seek_cnt;
 };
 
 #define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)
 #define IOC_REQ_DEVICE_IO_SZ    _IOR(IOC_MAGIC, 3, int)
+#define IOC_REQ_DEVICE_SCHED    _IOW(IOC_MAGIC, 4, int)
+#define IOC_REQ_SCHED_STATE     _IOR(IOC_MAGIC, 5, struct ddriver_sched_state)
+#define IOC_REQ_DEVICE_FLUSH    _IO(IOC_MAGIC, 6)
+#define IOC_REQ_DEVICE_CONFIG   _IOR(IOC_MAGIC, 7, struct ddriver_config)
+#define IOC_REQ_DEVICE_PROFILE  _IOW(IOC_MAGIC, 8, int)
+#define IOC_REQ_DEVICE_DELAY    _IOW(IOC_MAGIC, 9, int)
+#define IOC_REQ_DEVICE_TIME     _IOR(IOC_MAGIC, 10, struct ddriver_time)
+#define IOC_REQ_DEVICE_CLOCK    _IOR(IOC_MAGIC, 11, long long)
+#define IOC_REQ_DEVICE_STATS    _IOR(IOC_MAGIC, 12, struct ddriver_stats)
+#define IOC_REQ_TRACE_TAG       _IOW(IOC_MAGIC, 13, int)
+#define IOC_REQ_DEVICE_DISCARD  _IOW(IOC_MAGIC, 16, struct ddriver_range)
 
+struct ddriver_range
+{
+    long long offset;
+    long long size;
+};
+
+#define DDRIVER_BACKEND_ENV     "DDRIVER_BACKEND"
+#define DDRIVER_BACKEND_FILE    0
+#define DDRIVER_BACKEND_MMAP    1
+#define DDRIVER_BACKEND_KERNEL  2
+#define DDRIVER_BACKEND_STRIPE  3
+
+#define DDRIVER_STRIPE_PREFIX   "stripe:"
+#define DDRIVER_STRIPE_MAX      16
+
+/******************************************************************************
+* SECTION: Geometry definitions
+*******************************************************************************/
+struct ddriver_config
+{
+    long long capacity;
+    int       iounit_size;
+    int       track_num;
+    int       read_lat;
+    int       write_lat;
+    int       seek_lat;
+    int       xfer_lat;
+};
+
+#define DDRIVER_CONFIG_DEFAULT  { 4 * 1024 * 1024, 512, 100, 2000, 1000, 4000, 5 }
+
+#define DDRIVER_PROFILE_NONE    0
+#define DDRIVER_PROFILE_HDD     1
+#define DDRIVER_PROFILE_SATA    2
+#define DDRIVER_PROFILE_NVME    3
+#define DDRIVER_PROFILE_NR      4
+
+#define DDRIVER_DELAY_SLEEP     0
+#define DDRIVER_DELAY_SPIN      1
+#define DDRIVER_DELAY_VIRTUAL   2
+#define DDRIVER_DELAY_NR        3
+#define DDRIVER_CLOCK_ENV       "DDRIVER_CLOCK"
+
+struct ddriver_time
+{
+    long long device_us;
+    long long wall_us;
+};
+/******************************************************************************
+* SECTION: Async IO protocol definitions
+*******************************************************************************/
+#define DDRIVER_OP_READ         0
+#define DDRIVER_OP_WRITE        1
+
+struct ddriver_req
+{
+    int     op;
+    char*   buf;
+    size_t  size;
+    off_t   offset;
+    void*   priv;
+    int     res;
+};
+
+#define DDRIVER_SCHED_NOOP      0
+#define DDRIVER_SCHED_DEADLINE  1
+#define DDRIVER_SCHED_CSCAN     2
+#define DDRIVER_SCHED_NR        3
+
+struct ddriver_sched_stat
+{
+    long long dispatch_cnt;
+    long long seek_cnt;
+    long long seek_dist;
+    long long lat_us;
+    long long max_lat_us;
+};
+
+struct ddriver_sched_state
+{
+    int policy;
+    struct ddriver_sched_stat stat[DDRIVER_SCHED_NR];
+};
+
+/******************************************************************************
+* SECTION: Extended stats definitions
+*******************************************************************************/
+#define DDRIVER_OP_NR           2
+#define DDRIVER_HIST_NR         32
+#define DDRIVER_HEAT_NR         64
+
+struct ddriver_op_stat
+{
+    long long cnt;
+    long long bytes;
+    long long lat_us;
+    long long hist[DDRIVER_HIST_NR];
+};
+
+struct ddriver_stats
+{
+    struct ddriver_op_stat op[DDRIVER_OP_NR];
+    long long seek_cnt;
+    long long seek_dist;
+    long long busy_us;
+    long long region_sz;
+    long long heat[DDRIVER_OP_NR][DDRIVER_HEAT_NR];
+    long long discard_cnt;
+    long long discard_bytes;
+};
+
+/******************************************************************************
+* SECTION: Trace definitions
+*******************************************************************************/
+#define DDRIVER_TRACE_ENV       "DDRIVER_TRACE"
+#define DDRIVER_TRACE_MAGIC     0x44445452
+#define DDRIVER_TRACE_VERSION   1
+
+struct ddriver_trace_hdr
+{
+    int       magic;
+    int       version;
+    int       iounit_size;
+    int       reserved;
+    long long capacity;
+};
+
+struct ddriver_trace_rec
+{
+    long long ts_us;
+    long long offset;
+    int       size;
+    short     op;
+    short     tag;
+};
 #endif
\ No newline at end of file
@@ -29,6 +29,7 @@ int 			   sfs_driver_write(int offset, uint8_t *in_content, int size);
 
 int 			   sfs_mount(struct custom_options options);
 int 			   sfs_umount();
+int 			   sfs_discard_sync();
 
 int 			   sfs_alloc_dentry(struct sfs_inode * inode, struct sfs_dentry * dentry);
 int 			   sfs_drop_dentry(struct sfs_inode * inode, struct sfs_dentry * dentry);
@@ -112,6 +112,7 @@ struct sfs_super
     uint8_t*           map_inode;
     int                map_inode_blks;
     int                map_inode_offset;
+    uint8_t*           map_discard;                   /* 已释放待丢弃的inode，umount时批量下发 */
     
     int                data_offset;
 
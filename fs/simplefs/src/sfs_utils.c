@@ -50,15 +50,10 @@ int sfs_driver_read(int offset, uint8_t *out_content, int size) {
     int      bias           = offset - offset_aligned;
     int      size_aligned   = SFS_ROUND_UP((size + bias), SFS_IO_SZ());
     uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    // lseek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // read(SFS_DRIVER(), cur, SFS_IO_SZ());
-        ddriver_read(SFS_DRIVER(), cur, SFS_IO_SZ());
-        cur          += SFS_IO_SZ();
-        size_aligned -= SFS_IO_SZ();   
+    if (ddriver_pread(SFS_DRIVER(), (char *)temp_content, size_aligned,    /* 一次定位请求读出所有IO单位 */
+                      offset_aligned) < 0) {
+        free(temp_content);
+        return -SFS_ERROR_IO;
     }
     memcpy(out_content, temp_content + bias, size);
     free(temp_content);
@@ -77,18 +72,13 @@ int sfs_driver_write(int offset, uint8_t *in_content, int size) {
     int      bias           = offset - offset_aligned;
     int      size_aligned   = SFS_ROUND_UP((size + bias), SFS_IO_SZ());
     uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
     sfs_driver_read(offset_aligned, temp_content, size_aligned);
     memcpy(temp_content + bias, in_content, size);
     
-    // lseek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // write(SFS_DRIVER(), cur, SFS_IO_SZ());
-        ddriver_write(SFS_DRIVER(), cur, SFS_IO_SZ());
-        cur          += SFS_IO_SZ();
-        size_aligned -= SFS_IO_SZ();   
+    if (ddriver_pwrite(SFS_DRIVER(), (char *)temp_content, size_aligned,   /* 一次定位请求写入所有IO单位 */
+                       offset_aligned) < 0) {
+        free(temp_content);
+        return -SFS_ERROR_IO;
     }
 
     free(temp_content);
@@ -314,6 +304,7 @@ int sfs_drop_inode(struct sfs_inode * inode) {
             for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
                 if (ino_cursor == inode->ino) {
                      sfs_super.map_inode[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
+                     sfs_super.map_discard[byte_cursor] |= (0x1 << bit_cursor);
                      is_find = TRUE;
                      break;
                 }
@@ -547,6 +538,7 @@ int sfs_mount(struct custom_options options){
     sfs_super.sz_usage   = sfs_super_d.sz_usage;      /* 建立 in-memory 结构 */
     
     sfs_super.map_inode = (uint8_t *)malloc(SFS_BLKS_SZ(sfs_super_d.map_inode_blks));
+    sfs_super.map_discard = (uint8_t *)calloc(1, SFS_BLKS_SZ(sfs_super_d.map_inode_blks));
     sfs_super.map_inode_blks = sfs_super_d.map_inode_blks;
     sfs_super.map_inode_offset = sfs_super_d.map_inode_offset;
     sfs_super.data_offset = sfs_super_d.data_offset;
@@ -599,8 +591,44 @@ int sfs_umount() {
         return -SFS_ERROR_IO;
     }
 
+    sfs_discard_sync();                               /* 释放的inode区间交给设备丢弃 */
+
     free(sfs_super.map_inode);
+    free(sfs_super.map_discard);
     ddriver_close(SFS_DRIVER());
 
     return SFS_ERROR_NONE;
 }
+/**
+ * @brief 将已释放的inode及其数据块批量丢弃，相邻的合并为一次IOC_REQ_DEVICE_DISCARD
+ * 
+ * 释放后又被重新分配的inode仍在inode位图中占用，不会被丢弃
+ * @return int 
+ */
+int sfs_discard_sync() {
+    struct ddriver_range range;
+    int ino, start = -1;
+    int ret = SFS_ERROR_NONE;
+
+    for (ino = 0; ino <= sfs_super.max_ino; ino++) {
+        if (ino < sfs_super.max_ino &&
+            (sfs_super.map_discard[ino / UINT8_BITS] & (0x1 << (ino % UINT8_BITS))) &&
+            !(sfs_super.map_inode[ino / UINT8_BITS] & (0x1 << (ino % UINT8_BITS)))) {
+            if (start < 0) {
+                start = ino;
+            }
+            continue;
+        }
+        if (start >= 0) {
+            range.offset = SFS_INO_OFS(start);
+            range.size   = SFS_INO_OFS(ino) - SFS_INO_OFS(start);
+            if (ddriver_ioctl(SFS_DRIVER(), IOC_REQ_DEVICE_DISCARD, &range) < 0) {
+                SFS_DBG("[%s] discard error\n", __func__);
+                ret = -SFS_ERROR_IO;
+            }
+            start = -1;
+        }
+    }
+    memset(sfs_super.map_discard, 0, SFS_BLKS_SZ(sfs_super.map_inode_blks));
+    return ret;
+}
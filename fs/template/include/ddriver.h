@@ -3,14 +3,37 @@
 
 #include "ddriver_ctl_user.h"
 #include "stdio.h"
+#include <sys/uio.h>
 
 /**
  * @brief 打开ddriver设备
  * 
+ * @param path ddriver设备路径，可为任意磁盘镜像文件，同一进程可同时打开多个设备；
+ *             内核ddriver字符设备(如/dev/ddriver)时自动映射内核磁盘
+ * @return int 文件描述符，之后的调用以其区分设备；负数为失败
+ */
+int ddriver_open(char *path);
+
+/**
+ * @brief 以指定几何参数打开ddriver设备，配置保存在磁盘镜像末尾，之后的ddriver_open沿用
+ * 
  * @param path ddriver设备路径
+ * @param cfg 磁盘配置，NULL则沿用镜像中的配置，可由DDRIVER_CONFIG_DEFAULT初始化后修改
  * @return int 0成功，否则失败
  */
-int ddriver_open(char *path);
+int ddriver_open_ex(char *path, struct ddriver_config *cfg);
+
+/**
+ * @brief 将多个ddriver设备条带化(RAID-0)为一个逻辑设备，请求按条带单元拆分，
+ * 由各成员的工作线程并行服务；也可向ddriver_open传入 stripe:<条带单元>:<镜像1>,<镜像2>,...
+ * 
+ * @param paths 成员设备路径
+ * @param nr 成员个数，不超过DDRIVER_STRIPE_MAX
+ * @param stripe_unit 条带单元(B)，须为IO单位的整数倍
+ * @param cfg 各成员的磁盘配置，NULL则沿用各镜像中的配置
+ * @return int 逻辑设备的文件描述符，负数为失败
+ */
+int ddriver_open_stripe(char **paths, int nr, int stripe_unit, struct ddriver_config *cfg);
 
 /**
  * @brief 移动ddriver磁盘头
@@ -42,6 +65,86 @@ int ddriver_write(int fd, char *buf, size_t size);
  */
 int ddriver_read(int fd, char *buf, size_t size);
 
+/**
+ * @brief 向量写入数据，一次请求写入多个IO单位
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 要写入的数据段，每段大小须为设备IO单位的整数倍
+ * @param iovcnt 数据段个数
+ * @return int 写入的字节数，负数为失败
+ */
+int ddriver_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief 向量读出数据，一次请求读出多个IO单位
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 要读出的数据段，每段大小须为设备IO单位的整数倍
+ * @param iovcnt 数据段个数
+ * @return int 读出的字节数，负数为失败
+ */
+int ddriver_readv(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief 定位写入数据，不需要先ddriver_seek，可多线程并发调用
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要写入的数据Buf
+ * @param size 要写入的数据大小，须为设备IO单位的整数倍
+ * @param offset 写入位置，注意要和设备IO单位对齐
+ * @return int 写入的字节数，负数为失败
+ */
+int ddriver_pwrite(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 定位读出数据，不需要先ddriver_seek，可多线程并发调用
+ * 
+ * @param fd ddriver设备handler
+ * @param buf 要读出的数据Buf
+ * @param size 要读出的数据大小，须为设备IO单位的整数倍
+ * @param offset 读出位置，注意要和设备IO单位对齐
+ * @return int 读出的字节数，负数为失败
+ */
+int ddriver_pread(int fd, char *buf, size_t size, off_t offset);
+
+/**
+ * @brief 建立异步请求队列，ddriver_close时自动销毁
+ * 
+ * @param fd ddriver设备handler
+ * @param depth 队列深度，即最多同时在途的请求数
+ * @return int 0成功，否则失败
+ */
+int ddriver_queue_init(int fd, int depth);
+
+/**
+ * @brief 等待在途请求完成并销毁异步队列
+ * 
+ * @param fd ddriver设备handler
+ * @return int 0成功，否则失败
+ */
+int ddriver_queue_exit(int fd);
+
+/**
+ * @brief 提交异步请求，立即返回，各请求的模拟延迟相互重叠
+ * 
+ * @param fd ddriver设备handler
+ * @param reqs 请求数组，完成前请求及其buf须保持有效
+ * @param nr 请求个数
+ * @return int 实际提交的请求数，队列满时可能小于nr
+ */
+int ddriver_submit(int fd, struct ddriver_req **reqs, int nr);
+
+/**
+ * @brief 收割已完成的异步请求
+ * 
+ * @param fd ddriver设备handler
+ * @param reqs 输出已完成的请求，结果见req->res
+ * @param min_nr 至少等待完成的请求数
+ * @param max_nr 最多收割的请求数
+ * @return int 收割的请求数，负数为失败
+ */
+int ddriver_reap(int fd, struct ddriver_req **reqs, int min_nr, int max_nr);
+
 /**
  * @brief ddriver IO控制
  * 
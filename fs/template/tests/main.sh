@@ -7,6 +7,8 @@ ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
 ALL_TEST_SCORES=(1 4 5 4 16 2 2)
 MNTPOINT='./mnt'
 PROJECT_NAME="SAMPLE_PROJECT_NAME"
+# 虚拟设备时钟: 不真实等待，设备时间记录在 ~/ddriver_log
+export DDRIVER_CLOCK=${DDRIVER_CLOCK:-virtual}
 
 LEVEL=$1
 
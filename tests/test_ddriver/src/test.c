@@ -1,11 +1,32 @@
 #include "../include/ddriver.h"
 #include <linux/fs.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define STAT_THREADS 8
+#define STAT_LOOPS   1000
+
+int stat_fd;
+int stat_unit;
+
+void *stat_worker(void *arg) {
+    char buf[4096];
+    off_t offset = (long)arg * stat_unit;
+
+    for (int i = 0; i < STAT_LOOPS; i++) {
+        ddriver_pwrite(stat_fd, buf, stat_unit, offset);
+        ddriver_pread(stat_fd, buf, stat_unit, offset);
+    }
+    return NULL;
+}
 
 int main(int argc, char const *argv[])
 {
     int size;
     struct ddriver_state state;
-    int fd = ddriver_open("/home/students/200111326/ddriver");
+    char *path = "/home/students/200111326/ddriver";
+    int fd = ddriver_open(path);
     if (fd < 0) {
         return -1;
     }
@@ -27,9 +48,9 @@ int main(int argc, char const *argv[])
 
     /* Cycle 3: ioctl test - return struct */
     ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE, &state);
-    printf("read_cnt: %d\n", state.read_cnt);
-    printf("write_cnt: %d\n", state.write_cnt);
-    printf("seek_cnt: %d\n", state.seek_cnt);
+    printf("read_cnt: %lld\n", state.read_cnt);
+    printf("write_cnt: %lld\n", state.write_cnt);
+    printf("seek_cnt: %lld\n", state.seek_cnt);
 
     /* Cycle 4: ioctl test - re-init device */
     ddriver_ioctl(fd, IOC_REQ_DEVICE_RESET, &size);
@@ -38,10 +59,276 @@ int main(int argc, char const *argv[])
     printf("%d\n", size);
 
     ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE, &state);
-    printf("read_cnt: %d\n", state.read_cnt);
-    printf("write_cnt: %d\n", state.write_cnt);
-    printf("seek_cnt: %d\n", state.seek_cnt);
+    printf("read_cnt: %lld\n", state.read_cnt);
+    printf("write_cnt: %lld\n", state.write_cnt);
+    printf("seek_cnt: %lld\n", state.seek_cnt);
+
+    /* Cycle 5: vectored read/write test */
+    char vbuffer[3][512];
+    char vrbuffer[1536];
+    struct iovec iov[3];
+    for (int i = 0; i < 3; i++) {
+        memset(vbuffer[i], 'a' + i, 512);
+        iov[i].iov_base = vbuffer[i];
+        iov[i].iov_len  = 512;
+    }
+    ddriver_seek(fd, 512, SEEK_SET);
+    ddriver_writev(fd, iov, 3);
+    ddriver_seek(fd, 512, SEEK_SET);
+    iov[0].iov_base = vrbuffer;
+    iov[0].iov_len  = 1536;
+    ddriver_readv(fd, iov, 1);
+    if (vrbuffer[0] != 'a' || vrbuffer[512] != 'b' || vrbuffer[1535] != 'c') {
+        printf("readv mismatch\n");
+        return -1;
+    }
+
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE, &state);
+    printf("read_cnt: %lld\n", state.read_cnt);
+    printf("write_cnt: %lld\n", state.write_cnt);
+
+    /* Cycle 6: positional read/write test */
+    memset(vrbuffer, 0, sizeof(vrbuffer));
+    ddriver_pwrite(fd, vbuffer[2], 512, 4096);
+    ddriver_pread(fd, vrbuffer, 1024, 1024);
+    if (vrbuffer[0] != 'b' || vrbuffer[512] != 'c') {
+        printf("pread mismatch\n");
+        return -1;
+    }
+    ddriver_pread(fd, vrbuffer, 512, 4096);
+    if (vrbuffer[0] != 'c') {
+        printf("pread mismatch\n");
+        return -1;
+    }
+
+    /* Cycle 7: async submit/reap test */
+    struct ddriver_req reqs[3];
+    struct ddriver_req *preqs[3];
+    ddriver_queue_init(fd, 4);
+    for (int i = 0; i < 3; i++) {
+        reqs[i].op     = DDRIVER_OP_READ;
+        reqs[i].buf    = vrbuffer + i * 512;
+        reqs[i].size   = 512;
+        reqs[i].offset = 512 * (i + 1);
+        preqs[i]       = &reqs[i];
+    }
+    if (ddriver_submit(fd, preqs, 3) != 3 || ddriver_reap(fd, preqs, 3, 3) != 3) {
+        printf("async io failed\n");
+        return -1;
+    }
+    if (vrbuffer[0] != 'a' || vrbuffer[512] != 'b' || vrbuffer[1024] != 'c') {
+        printf("async read mismatch\n");
+        return -1;
+    }
+
+    /* Cycle 8: scheduler test */
+    struct ddriver_sched_state sched_state;
+    int policy = DDRIVER_SCHED_CSCAN;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SCHED, &policy);
+    for (int i = 0; i < 3; i++) {
+        reqs[i].offset = 512 * (3 - i);
+    }
+    ddriver_submit(fd, preqs, 3);
+    ddriver_reap(fd, preqs, 3, 3);
+    ddriver_ioctl(fd, IOC_REQ_SCHED_STATE, &sched_state);
+    printf("cscan dispatch_cnt: %lld\n", sched_state.stat[DDRIVER_SCHED_CSCAN].dispatch_cnt);
+    printf("cscan seek_cnt: %lld\n", sched_state.stat[DDRIVER_SCHED_CSCAN].seek_cnt);
+    ddriver_close(fd);
+
+    /* Cycle 9: geometry test - reopen as 8MiB disk with 4KiB io unit */
+    struct ddriver_config cfg = DDRIVER_CONFIG_DEFAULT;
+    char buf[4096];
+    cfg.capacity = 8 * 1024 * 1024;
+    cfg.iounit_size = 4096;
+    fd = ddriver_open_ex(path, &cfg);
+    memset(buf, 'g', 4096);
+    ddriver_pwrite(fd, buf, 4096, cfg.capacity - 4096);
     ddriver_close(fd);
+    fd = ddriver_open(path);                          /* geometry persisted */
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_CONFIG, &cfg);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_IO_SZ, &size);
+    printf("capacity: %lld\n", cfg.capacity);
+    memset(buf, 0, 4096);
+    ddriver_pread(fd, buf, 4096, cfg.capacity - 4096);
+    if (cfg.capacity != 8 * 1024 * 1024 || size != 4096 || buf[4095] != 'g') {
+        printf("geometry mismatch\n");
+        return -1;
+    }
+    ddriver_close(fd);
+    cfg = (struct ddriver_config)DDRIVER_CONFIG_DEFAULT;
+    if (ddriver_open_ex(path, &cfg) >= 0) {           /* shrinking would drop data */
+        printf("shrink not rejected\n");
+        return -1;
+    }
+    unlink(path);
+    fd = ddriver_open_ex(path, &cfg);                 /* restore default geometry */
+
+    /* Cycle 10: latency profile test - virtual delay accounts device time only */
+    struct ddriver_time dtime;
+    int profile = DDRIVER_PROFILE_HDD;
+    int mode = DDRIVER_DELAY_VIRTUAL;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_PROFILE, &profile);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_DELAY, &mode);
+    for (int i = 0; i < 64; i++) {
+        ddriver_pread(fd, buf, 512, 512 * ((i * 37) % 64));
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_TIME, &dtime);
+    printf("device_us: %lld, wall_us: %lld\n", dtime.device_us, dtime.wall_us);
+    if (dtime.device_us < 64 * 2000 || dtime.wall_us >= dtime.device_us) {
+        printf("virtual delay mismatch\n");
+        return -1;
+    }
+    long long clock;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_CLOCK, &clock);
+    if (clock != dtime.device_us) {
+        printf("device clock mismatch\n");
+        return -1;
+    }
+
+    /* Cycle 11: extended stats test */
+    struct ddriver_stats stats;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS, &stats);
+    printf("read bytes: %lld, seek_dist: %lld, region_sz: %lld\n", 
+           stats.op[DDRIVER_OP_READ].bytes, stats.seek_dist, stats.region_sz);
+    if (stats.op[DDRIVER_OP_READ].cnt != 64 || stats.op[DDRIVER_OP_READ].bytes != 64 * 512 ||
+        stats.heat[DDRIVER_OP_READ][0] != 64 * 512 || stats.busy_us != clock) {
+        printf("extended stats mismatch\n");
+        return -1;
+    }
+
+    /* Cycle 12: queued requests overlap on the virtual clock, sync ones add up */
+    struct ddriver_req vreqs[8];
+    struct ddriver_req *pvreqs[8];
+    char vbuf[8][512];
+    long long c0, c1, c2;
+    ddriver_queue_init(fd, 8);
+    for (int i = 0; i < 8; i++) {
+        vreqs[i].op     = DDRIVER_OP_READ;
+        vreqs[i].buf    = vbuf[i];
+        vreqs[i].size   = 512;
+        vreqs[i].offset = 512 * 8 * i;
+        pvreqs[i]       = &vreqs[i];
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_CLOCK, &c0);
+    ddriver_submit(fd, pvreqs, 8);
+    ddriver_reap(fd, pvreqs, 8, 8);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_CLOCK, &c1);
+    for (int i = 0; i < 8; i++) {
+        ddriver_pread(fd, vbuf[i], 512, 512 * 8 * i);
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_CLOCK, &c2);
+    ddriver_queue_exit(fd);
+    printf("async clock: %lld us, sync clock: %lld us\n", c1 - c0, c2 - c1);
+    if (c1 - c0 >= c2 - c1 || c1 - c0 < 2000) {
+        printf("virtual overlap mismatch\n");
+        return -1;
+    }
+
+    /* Cycle 13: discard test - discarded range reads back as zero */
+    struct ddriver_range range = { .offset = 1024, .size = 512 };
+    memset(buf, 'd', 512);
+    ddriver_pwrite(fd, buf, 512, 1024);
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_DISCARD, &range);
+    ddriver_pread(fd, buf, 512, 1024);
+    if (buf[0] != 0 || buf[511] != 0) {
+        printf("discard mismatch\n");
+        return -1;
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_STATS, &stats);
+    if (stats.discard_cnt != 1 || stats.discard_bytes != 512) {
+        printf("discard stats mismatch: %lld, %lld\n", stats.discard_cnt, stats.discard_bytes);
+        return -1;
+    }
+
+    /* Cycle 14: multi-device test - a second image opened side by side */
+    char path_b[256];
+    char buf_b[512];
+    sprintf(path_b, "%s_b", path);
+    int fd_b = ddriver_open(path_b);
+    if (fd_b < 0 || fd_b == fd) {
+        printf("second device open failed\n");
+        return -1;
+    }
+    memset(buf, 'a', 512);
+    memset(buf_b, 'b', 512);
+    ddriver_pwrite(fd, buf, 512, 0);
+    ddriver_pwrite(fd_b, buf_b, 512, 0);
+    ddriver_pread(fd, buf, 512, 0);
+    ddriver_pread(fd_b, buf_b, 512, 0);
+    if (buf[0] != 'a' || buf_b[0] != 'b') {
+        printf("devices share data\n");
+        return -1;
+    }
+    ddriver_ioctl(fd_b, IOC_REQ_DEVICE_STATE, &state);
+    if (state.write_cnt != 1 || state.read_cnt != 1) {
+        printf("devices share state: %lld, %lld\n", state.write_cnt, state.read_cnt);
+        return -1;
+    }
+    ddriver_close(fd_b);
+    unlink(path_b);
+    ddriver_close(fd);
+
+    /* Cycle 15: stripe test - units alternate between members */
+    char spec[600];
+    char stripe_buf[4 * 4096];
+    sprintf(spec, DDRIVER_STRIPE_PREFIX "4096:%s_b,%s_c", path, path);
+    fd = ddriver_open(spec);
+    if (fd < 0) {
+        printf("stripe open failed\n");
+        return -1;
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_CONFIG, &cfg);
+    if (cfg.capacity != 2 * 4 * 1024 * 1024) {
+        printf("stripe capacity mismatch: %lld\n", cfg.capacity);
+        return -1;
+    }
+    for (int i = 0; i < 4; i++) {
+        memset(stripe_buf + i * 4096, 'A' + i, 4096);
+    }
+    ddriver_pwrite(fd, stripe_buf, sizeof(stripe_buf), 0);
+    memset(stripe_buf, 0, sizeof(stripe_buf));
+    ddriver_pread(fd, stripe_buf, sizeof(stripe_buf), 0);
+    for (int i = 0; i < 4; i++) {
+        if (stripe_buf[i * 4096] != 'A' + i || stripe_buf[i * 4096 + 4095] != 'A' + i) {
+            printf("stripe data mismatch at unit %d\n", i);
+            return -1;
+        }
+    }
+    ddriver_close(fd);
+    fd_b = ddriver_open(path_b);                      /* Units 0 and 2 live on the first member */
+    ddriver_pread(fd_b, stripe_buf, 4096, 0);
+    ddriver_pread(fd_b, stripe_buf + 4096, 4096, 4096);
+    if (stripe_buf[0] != 'A' || stripe_buf[4096] != 'C') {
+        printf("stripe layout mismatch\n");
+        return -1;
+    }
+    ddriver_close(fd_b);
+    unlink(path_b);
+    sprintf(path_b, "%s_c", path);
+    unlink(path_b);
+
+    /* Cycle 16: concurrent stats test - no increment lost across threads */
+    pthread_t workers[STAT_THREADS];
+    profile = DDRIVER_PROFILE_NONE;
+    stat_fd = ddriver_open(path);
+    ddriver_ioctl(stat_fd, IOC_REQ_DEVICE_IO_SZ, &stat_unit);
+    ddriver_ioctl(stat_fd, IOC_REQ_DEVICE_PROFILE, &profile);
+    ddriver_ioctl(stat_fd, IOC_REQ_DEVICE_RESET, NULL);
+    for (long i = 0; i < STAT_THREADS; i++) {
+        pthread_create(&workers[i], NULL, stat_worker, (void *)i);
+    }
+    for (int i = 0; i < STAT_THREADS; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    ddriver_ioctl(stat_fd, IOC_REQ_DEVICE_STATE, &state);
+    ddriver_ioctl(stat_fd, IOC_REQ_DEVICE_STATS, &stats);
+    if (state.write_cnt != STAT_THREADS * STAT_LOOPS || state.read_cnt != STAT_THREADS * STAT_LOOPS ||
+        stats.op[DDRIVER_OP_WRITE].cnt != STAT_THREADS * STAT_LOOPS) {
+        printf("lost stats: %lld, %lld, %lld\n", state.write_cnt, state.read_cnt,
+               stats.op[DDRIVER_OP_WRITE].cnt);
+        return -1;
+    }
+    ddriver_close(stat_fd);
 
     printf("Test Pass :)\n");
     return 0;